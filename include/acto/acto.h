@@ -6,17 +6,24 @@
 #include <atomic>
 #include <bit>
 #include <cassert>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <optional>
+#include <span>
 #include <thread>
-#include <typeindex>
-#include <typeinfo>
-#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace acto {
 
 class actor;
+class actor_ref;
+class runtime;
 
 enum class actor_thread {
   /// Use shared pool of threads for the actor.
@@ -31,11 +38,143 @@ enum class actor_thread {
   bind,
 };
 
+/**
+ * Scheduling priority of an actor in the shared pool.
+ *
+ * Runnable actors of a higher priority are served first. Actors of lower
+ * priorities are still given a time slice after being passed over a few
+ * times, so they cannot starve.
+ */
+enum class actor_priority : uint8_t {
+  low,
+  normal,
+  high,
+};
+
+/**
+ * Behavior of a bounded mailbox when it is full.
+ */
+enum class overflow_policy {
+  /// The message is not delivered, send returns false.
+  reject,
+
+  /// The oldest messages are discarded to make room for new ones,
+  /// so the newest message is always accepted.
+  /// Messages are discarded when the actor selects the next message.
+  /// If the actor falls behind by twice the capacity, the sender
+  /// discards the oldest messages the actor has not taken yet.
+  drop_oldest,
+
+  /// The sender waits until there is room in the mailbox.
+  /// Senders on threads managed by the library or inside handlers
+  /// are rejected instead to prevent deadlocks.
+  block,
+};
+
+/**
+ * Strategy of a router selecting a routee for a message.
+ */
+enum class routing_strategy {
+  /// Routees are selected in turn.
+  round_robin,
+
+  /// A routee is selected at random.
+  random,
+
+  /// The routee with the least number of messages in the mailbox
+  /// is selected.
+  smallest_mailbox,
+
+  /// Messages with equal keys are sent to the same routee.
+  /// Keys are computed by functions set for message types.
+  /// Messages of other types are routed in turn.
+  consistent_hash,
+};
+
+/**
+ * Parameters of the runtime.
+ */
+struct runtime_config {
+  /// Number of workers in the shared pool the scheduler aims at.
+  /// Zero means the number of hardware threads.
+  unsigned int concurrency{0};
+  /// Number of workers which are never stopped by the shrink policy.
+  unsigned int min_workers{0};
+  /// Upper bound of the shared pool growth.
+  unsigned int max_workers{512};
+  /// Time slice of an actor in the shared pool.
+  std::chrono::nanoseconds time_slice{std::chrono::milliseconds(500)};
+  /// Maximum number of messages an actor handles per time slice.
+  /// Zero means the slice is limited by time only.
+  unsigned int slice_messages{0};
+  /// The clock is read once per the given number of handled messages
+  /// to check the time slice has elapsed.
+  unsigned int slice_check_interval{1};
+  /// An actor woken from a handler is run next by the same worker.
+  /// The value limits how many times in a row the worker may do so
+  /// before serving its run queue. Zero disables the behavior.
+  unsigned int next_slot_limit{16};
+  /// Growth policy.
+  /// An extra worker above the concurrency level is started if runnable
+  /// actors have been waiting for a free worker longer than the timeout.
+  /// The timeout is increased by the same amount after each growth.
+  std::chrono::nanoseconds grow_timeout{std::chrono::seconds(2)};
+  /// Shrink policy.
+  /// One idle worker is stopped per interval, all idle workers are
+  /// stopped if the runtime had no work during the interval.
+  std::chrono::nanoseconds idle_timeout{std::chrono::seconds(60)};
+  /// Duration of spinning of an idle worker before it will be parked.
+  std::chrono::nanoseconds spin_before_park{0};
+  /// CPUs the workers are pinned to.
+  /// Empty set means no pinning.
+  std::vector<unsigned int> cpus{};
+  /// Groups workers by NUMA nodes and pins them to CPUs of their node.
+  /// Runnable actors prefer workers of the node they were last run on.
+  bool numa_aware{false};
+  /// Resolution of timers and delays.
+  std::chrono::nanoseconds timer_tick{std::chrono::milliseconds(1)};
+};
+
+/**
+ * Allocator of message envelopes.
+ *
+ * The size passed to deallocate is the same as was passed to allocate.
+ * Messages may be freed on a thread other than the one they were
+ * allocated on.
+ */
+struct message_allocator {
+  void* (*allocate)(size_t size);
+  void (*deallocate)(void* ptr, size_t size);
+};
+
+/**
+ * Replaces the allocator of message envelopes.
+ *
+ * By default messages are allocated from per-thread pools. Memory of
+ * the pools is never returned to the system, so it stays at the peak
+ * reached by a burst of messages and is only reused by later ones.
+ * An empty allocator restores the default one.
+ *
+ * @return false if the first message has been allocated already, so
+ *         the allocator cannot be replaced anymore.
+ */
+bool set_message_allocator(const message_allocator& alloc);
+
+/**
+ * Returns the default allocator of per-thread pools, so a custom
+ * allocator can delegate to it.
+ */
+message_allocator default_message_allocator() noexcept;
+
 namespace core {
 
 class runtime_t;
 class worker_t;
+struct arena_t;
 struct msg_t;
+struct reply_t;
+struct router_t;
+struct timer_entry_t;
 
 /**
  * Core object.
@@ -48,51 +187,233 @@ struct object_t : public intrusive::node<object_t> {
   using atomic_stack = intrusive::mpsc_stack<msg_t>;
   using intusive_stack = intrusive::stack<msg_t>;
 
-  /// State mutex.
+  /// The object is being deleted and does not accept new messages.
+  static constexpr uint32_t DELETING = 1u << 0;
+  /// The object has been placed into a run queue, is being processed by a
+  /// worker or has a dedicated thread.
+  static constexpr uint32_t SCHEDULED = 1u << 1;
+  /// A handler of the object is suspended, so the object will be
+  /// deconstructed after the handler completes.
+  /// Not used for objects bound to a thread.
+  static constexpr uint32_t SUSPENDED = 1u << 2;
+  /// Unit of the counter of senders enqueuing messages.
+  static constexpr uint32_t SENDER = 1u << 3;
+
+  /// A coroutine handler of the object is suspended.
+  static constexpr uint32_t AWAITING = 1;
+  /// The awaited operation has completed and the handler can be resumed.
+  static constexpr uint32_t RESUMABLE = 2;
+
+  /// Runtime the object belongs to.
+  runtime_t* const runtime;
+  /// Guards deconstruction of the object.
   std::mutex cs;
   /// Pointer to the object inherited from the actor class (aka actor body).
   actor* impl;
   /// Dedicated thread for the object.
+  /// Reset on deconstruction, which never completes while some senders
+  /// are registered, so senders read it without the lock.
   worker_t* thread{nullptr};
   /// Queue of input messages implemented with two stacks.
   atomic_stack input_stack;
   intusive_stack local_stack;
+  /// Serializes senders evicting the oldest messages from the input
+  /// stack with the actor taking the messages.
+  intrusive::spin_lock evict_lock;
   /// Count of references to the object.
   std::atomic<unsigned long> references{0};
+  /// NUMA node of the worker which has run the object last time.
+  std::atomic<unsigned int> node{0};
+  /// Scheduling priority.
+  const actor_priority priority;
+  /// Maximum number of messages in the mailbox.
+  /// Zero means the mailbox is unbounded.
+  const unsigned long capacity;
+  /// What to do with a message if the mailbox is full.
+  const overflow_policy overflow;
+  /// Number of messages in the mailbox including ones being sent.
+  /// Maintained for bounded mailboxes and for routees of routers
+  /// selecting the smallest mailbox.
+  std::atomic<unsigned long> queued{0};
+  /// Number of routers selecting the object by the size of its mailbox.
+  std::atomic<unsigned int> observers{0};
+  /// Number of senders waiting for room in the mailbox.
+  std::atomic<unsigned int> blocked_senders{0};
+  /// Some room in the mailbox become available event.
+  event space_event{true};
   /// List of events awaiting for object deconstruction.
   waiter_t* waiters{nullptr};
-  /// State flags.
-  const uint32_t binded : 1;
-  const uint32_t exclusive : 1;
-  uint32_t deleting : 1;
-  uint32_t scheduled : 1;
+  /// Links in the registry of the runtime.
+  object_t* registry_prev{nullptr};
+  object_t* registry_next{nullptr};
+  /// Shard of the registry the object is linked to.
+  uint32_t registry_shard{UINT32_MAX};
+  /// State flags and the number of senders in progress.
+  /// Senders are counted so the object is not deconstructed until
+  /// the messages being sent are enqueued.
+  std::atomic<uint32_t> state{0};
+  /// State of a suspended coroutine handler.
+  /// Other messages are not selected until the handler completes.
+  std::atomic<uint32_t> suspension{0};
+  /// Thread options.
+  const bool binded;
+  const bool exclusive;
+  /// Block of memory the object and its body are placed into.
+  /// Null if both are allocated separately.
+  arena_t* const arena{nullptr};
+  /// Routing table if the object is a router.
+  /// Routers have no body and never receive messages themselves.
+  router_t* const router{nullptr};
+  /// Slot of the reply if the object is the sender of a request.
+  reply_t* const reply{nullptr};
 
 public:
-  object_t(const actor_thread thread_opt, std::unique_ptr<actor> body);
+  object_t(runtime_t* const owner,
+           const actor_thread thread_opt,
+           const actor_priority prio,
+           std::unique_ptr<actor> body);
+
+  /// Constructs an object of the shared pool with the body placed
+  /// into the arena.
+  object_t(runtime_t* const owner, actor* const body, arena_t* const block);
+
+  /// Constructs a router.
+  object_t(runtime_t* const owner, router_t* const table);
 
-  /// Pushes a message into the mailbox.
-  void enqueue(std::unique_ptr<msg_t> msg) noexcept;
+  /// Constructs the sender of a request.
+  object_t(runtime_t* const owner, reply_t* const slot);
+
+  /// Pushes the linked chain of messages into the mailbox.
+  /// The first message of the chain is the latest one.
+  void enqueue(msg_t* const first, msg_t* const last) noexcept;
 
   /// Whether any messages in the mailbox.
   bool has_messages() const noexcept;
 
+  /// Whether a message can be selected from the mailbox.
+  /// A suspended handler blocks the mailbox until it can be resumed.
+  bool runnable() const noexcept;
+
   /// Selects a message from the mailbox.
-  std::unique_ptr<msg_t> select_message() noexcept;
+  /// Messages received since the last refill of the local stack are not
+  /// taken into account unless refill is set.
+  std::unique_ptr<msg_t> select_message(const bool refill = true) noexcept;
+
+  /// Discards the oldest messages the actor has not taken yet, so the
+  /// mailbox does not hold more than the capacity.
+  /// Called by senders of a mailbox with the drop_oldest policy.
+  void evict_oldest() noexcept;
+
+  /// Resets the scheduled state.
+  /// @return the state observed by the reset. SCHEDULED is set if some
+  ///         messages have arrived meanwhile and the state has been
+  ///         restored by the call.
+  uint32_t unschedule() noexcept;
+
+private:
+  msg_t* pop_message(const bool refill) noexcept;
+
+  /// Claims up to the given number of messages above the capacity.
+  /// @return number of messages to be discarded.
+  unsigned long take_excess(const unsigned long limit) noexcept;
+};
+
+/**
+ * Block of memory holding objects spawned together.
+ *
+ * Each slot of the block keeps the core object followed by the body of
+ * the actor. Slots are aligned to a cache line, so neighbouring objects
+ * do not share one. The block is released when the last of its objects
+ * has been deleted.
+ */
+struct arena_t {
+  /// Number of slots.
+  const size_t count;
+  /// Alignment of the block and its slots.
+  const size_t alignment;
+  /// Offset of the first slot within the block.
+  const size_t start;
+  /// Offset of the body within a slot.
+  const size_t offset;
+  /// Size of a slot.
+  const size_t stride;
+  /// Number of objects which have not been deleted yet.
+  std::atomic<size_t> references;
+
+  arena_t(size_t n, size_t body_size, size_t body_alignment) noexcept;
+
+  /// Memory for the core object of the given slot.
+  void* object(const size_t i) noexcept {
+    return reinterpret_cast<char*>(this) + start + i * stride;
+  }
+
+  /// Memory for the body of the given slot.
+  void* body(const size_t i) noexcept {
+    return static_cast<char*>(object(i)) + offset;
+  }
+};
+
+/**
+ * Allocates an arena for the given number of bodies.
+ */
+arena_t* make_arena(size_t count, size_t body_size, size_t body_alignment);
+
+/**
+ * Releases memory of the arena.
+ */
+void delete_arena(arena_t* const arena) noexcept;
+
+/**
+ * Allocates next identifier for a message type.
+ */
+uint32_t next_type_id() noexcept;
+
+template <typename T>
+struct type_id_holder {
+  static uint32_t get() noexcept {
+    static const uint32_t id = next_type_id();
+    return id;
+  }
 };
 
+/**
+ * Dense identifier of the message type.
+ *
+ * Identifiers are assigned sequentially on first use of the type,
+ * so they can be used as indices of a flat table.
+ */
+template <typename T>
+inline uint32_t type_id() noexcept {
+  return type_id_holder<std::remove_cv_t<T>>::get();
+}
+
 struct msg_t : intrusive::node<msg_t> {
   /// Unique code for the message type.
-  const std::type_index type;
+  const uint32_t type;
+  /// The envelope refers to a payload shared with other envelopes.
+  const bool shared;
+  /// The message is counted in the size of the mailbox.
+  bool counted{false};
   /// Sender of the message.
   /// Can be empty.
   object_t* sender{nullptr};
 
 public:
-  constexpr msg_t(const std::type_index& idx) noexcept
-    : type(idx) {
+  constexpr msg_t(const uint32_t id, const bool is_shared = false) noexcept
+    : type(id)
+    , shared(is_shared) {
   }
 
   virtual ~msg_t();
+
+  /// Envelopes are allocated with the message allocator.
+  static void* operator new(size_t size);
+  static void* operator new(size_t size, std::align_val_t al);
+
+  static void operator delete(void* ptr, size_t size) noexcept;
+  static void operator delete(void* ptr,
+                              size_t size,
+                              std::align_val_t al) noexcept;
 };
 
 template <typename T, bool>
@@ -153,18 +474,274 @@ struct msg_wrap_t
   template <typename... Args>
   constexpr msg_wrap_t(Args&&... args) noexcept(
     std::is_nothrow_constructible_v<message_container_t<T>, Args...>)
-    : msg_t(typeid(T))
+    : msg_t(type_id<T>())
     , message_container_t<T>(std::forward<Args>(args)...) {
   }
 };
 
+/**
+ * Immutable payload of a message sent to many actors.
+ */
+struct shared_payload_t {
+  /// Number of envelopes referring to the payload.
+  std::atomic<unsigned long> references{0};
+
+  virtual ~shared_payload_t() = default;
+};
+
+template <typename T>
+struct shared_value_t final : shared_payload_t {
+  template <typename... Args>
+  shared_value_t(Args&&... args)
+    : value(std::forward<Args>(args)...) {
+  }
+
+  const T value;
+};
+
+/**
+ * Envelope of a shared payload.
+ */
+struct msg_shared_t final : msg_t {
+  shared_payload_t* const payload;
+
+  msg_shared_t(const uint32_t id, shared_payload_t* const p) noexcept
+    : msg_t(id, true)
+    , payload(p) {
+  }
+
+  ~msg_shared_t() override;
+
+  template <typename T>
+  const T& value() const noexcept {
+    return static_cast<const shared_value_t<T>*>(payload)->value;
+  }
+};
+
+/**
+ * Slot of the reply to a request.
+ *
+ * The object of the slot is the sender of the request, so the reply
+ * sent to it is stored in the slot instead of a mailbox. Only the first
+ * message of the expected type is accepted. The slot is released when
+ * both the future and the object are gone.
+ */
+struct reply_t {
+  /// No reply yet.
+  static constexpr uint32_t PENDING = 0;
+  /// The reply is being stored.
+  static constexpr uint32_t CLAIMED = 1;
+  /// The reply has been stored.
+  static constexpr uint32_t REPLIED = 2;
+  /// No reply will arrive, as all references to the object are gone.
+  static constexpr uint32_t BROKEN = 3;
+
+  /// Sender of the request.
+  object_t object;
+  /// Type of the expected reply.
+  const uint32_t type;
+  std::atomic<uint32_t> state{PENDING};
+  /// The future and the object.
+  std::atomic<uint32_t> owners{2};
+  /// The reply.
+  msg_t* msg{nullptr};
+  /// The request has been completed.
+  event done;
+  /// Object whose coroutine handler awaits the reply.
+  std::atomic<object_t*> waiter{nullptr};
+
+  reply_t(runtime_t* const owner, const uint32_t reply_type);
+  ~reply_t();
+
+  /// Releases one of the owners.
+  void release() noexcept;
+};
+
+/**
+ * Sends the request on behalf of a new reply slot.
+ */
+reply_t* ask(const actor_ref& target,
+             std::unique_ptr<msg_t> msg,
+             const uint32_t reply_type);
+
+/**
+ * Allocates a frame of a coroutine from the cache of the active actor.
+ */
+void* allocate_frame(const size_t size);
+
+/**
+ * Returns the frame to the cache of the actor it was allocated for.
+ */
+void deallocate_frame(void* const ptr) noexcept;
+
+/**
+ * Suspends the coroutine handler of the active actor until the request
+ * is completed. Blocks the thread if there is no active actor.
+ * @return false if the coroutine should not be suspended.
+ */
+bool await_reply(reply_t* const slot, const std::coroutine_handle<> h);
+
+/**
+ * Suspends the coroutine handler of the active actor until the deadline.
+ * Blocks the thread if there is no active actor.
+ * @return false if the coroutine should not be suspended.
+ */
+bool await_delay(const std::chrono::steady_clock::time_point deadline,
+                 const std::coroutine_handle<> h);
+
+/**
+ * Returns the value carried by the envelope.
+ */
+template <typename T>
+const T& message_value(const msg_t* const msg) noexcept {
+  if (msg->shared) {
+    return static_cast<const msg_shared_t*>(msg)->value<T>();
+  }
+  return static_cast<const msg_wrap_t<T>*>(msg)->data();
+}
+
+/**
+ * Computes the routing key of a message.
+ */
+struct key_function_t {
+  virtual ~key_function_t() = default;
+
+  virtual uint64_t operator()(const msg_t* const msg) const = 0;
+};
+
+template <typename M, typename F>
+struct key_function_impl_t final : key_function_t {
+  template <typename T>
+  explicit key_function_impl_t(T&& f)
+    : func(std::forward<T>(f)) {
+  }
+
+  uint64_t operator()(const msg_t* const msg) const final {
+    return uint64_t(func(message_value<M>(msg)));
+  }
+
+  const F func;
+};
+
+/// Sends the shared payload to all targets.
+/// Takes ownership of the payload.
+size_t multicast(std::span<const actor_ref> targets,
+                 shared_payload_t* const payload,
+                 const uint32_t type);
+
+/// Sends the message to the target after the delay.
+/// @return handle of the timer or null if the target is empty.
+timer_entry_t* send_after(const actor_ref& target,
+                          const std::chrono::nanoseconds delay,
+                          std::unique_ptr<msg_t> msg);
+
+/// Sends the shared payload to the target every period.
+/// Takes ownership of the payload.
+/// @return handle of the timer or null if the target is empty.
+timer_entry_t* send_every(const actor_ref& target,
+                          const std::chrono::nanoseconds period,
+                          shared_payload_t* const payload,
+                          const uint32_t type);
+
+/// Cancels the timer.
+bool cancel_timer(timer_entry_t* const entry);
+
+/// Releases the handle of the timer.
+void release_timer(timer_entry_t* const entry) noexcept;
+
 } // namespace core
 
+/**
+ * Functions computing keys of messages for consistent hashing.
+ */
+class routing_keys {
+  friend class core::runtime_t;
+
+public:
+  /// Sets the function computing the key of messages of the given type.
+  /// The function takes the message by const reference and returns
+  /// an integer.
+  template <typename M, typename F>
+  routing_keys& key(F&& func) {
+    set_key(core::type_id<M>(),
+            std::make_shared<core::key_function_impl_t<M, std::decay_t<F>>>(
+              std::forward<F>(func)));
+    return *this;
+  }
+
+private:
+  void set_key(const uint32_t type,
+               std::shared_ptr<const core::key_function_t> f);
+
+private:
+  /// Functions indexed by type id.
+  /// The functions are shared by copies of the object.
+  std::vector<std::shared_ptr<const core::key_function_t>> keys_;
+};
+
+/**
+ * Messages to be sent to an actor at once.
+ *
+ * The messages are linked into a chain as they are added, so sending
+ * the batch updates the mailbox of the actor with a single atomic
+ * operation and makes a single scheduling decision.
+ */
+class message_batch {
+  friend class actor_ref;
+
+public:
+  constexpr message_batch() noexcept = default;
+
+  message_batch(message_batch&& rhs) noexcept;
+
+  message_batch(const message_batch&) = delete;
+  message_batch& operator=(const message_batch&) = delete;
+
+  ~message_batch();
+
+public:
+  /** Appends a message to the batch. */
+  template <typename Msg>
+  void add(Msg&& msg) {
+    push(std::make_unique<core::msg_wrap_t<std::remove_cvref_t<Msg>>>(
+      std::forward<Msg>(msg)));
+  }
+
+  /** Appends a message constructed in place to the batch. */
+  template <typename Msg, typename... P>
+  void emplace(P&&... p) {
+    push(std::make_unique<core::msg_wrap_t<std::remove_cvref_t<Msg>>>(
+      std::forward<P>(p)...));
+  }
+
+  /** Destroys all messages of the batch. */
+  void clear() noexcept;
+
+  bool empty() const noexcept {
+    return size_ == 0;
+  }
+
+  size_t size() const noexcept {
+    return size_;
+  }
+
+private:
+  void push(std::unique_ptr<core::msg_t> msg) noexcept;
+
+private:
+  /// The latest message.
+  core::msg_t* head_{nullptr};
+  /// The earliest message.
+  core::msg_t* tail_{nullptr};
+  size_t size_{0};
+};
+
 /**
  * Reference to an actor object.
  */
 class actor_ref {
   friend struct std::hash<actor_ref>;
+  friend class core::runtime_t;
   friend void join(const actor_ref& obj);
   friend void destroy(const actor_ref& object);
 
@@ -217,6 +794,45 @@ public:
         std::forward<P>(p)...));
   }
 
+  /**
+   * Sends a message to the actor if there is room in its mailbox.
+   *
+   * Never waits and never discards other messages regardless of
+   * the overflow policy of the actor.
+   * @return true if the message has been placed into the actor's mailbox.
+   */
+  template <typename Msg>
+  inline bool try_send(Msg&& msg) const {
+    if (!object_) {
+      return false;
+    }
+
+    return try_send_message(
+      std::make_unique<core::msg_wrap_t<std::remove_cvref_t<Msg>>>(
+        std::forward<Msg>(msg)));
+  }
+
+  template <typename Msg, typename... P>
+  inline bool try_send(P&&... p) const {
+    if (!object_) {
+      return false;
+    }
+
+    return try_send_message(
+      std::make_unique<core::msg_wrap_t<std::remove_cvref_t<Msg>>>(
+        std::forward<P>(p)...));
+  }
+
+  /**
+   * Sends all messages of the batch to the actor in the order they have
+   * been added to the batch.
+   *
+   * A bounded mailbox should have room for the whole batch.
+   * The batch is empty after the call.
+   * @return true if the messages have been placed into the actor's mailbox.
+   */
+  bool send_batch(message_batch&& batch) const;
+
   /**
    * Sends a message to the actor.
    *
@@ -270,6 +886,9 @@ private:
   /// Dispatches a message.
   bool send_message(std::unique_ptr<core::msg_t> msg) const;
 
+  /// Dispatches a message if there is room in the mailbox.
+  bool try_send_message(std::unique_ptr<core::msg_t> msg) const;
+
   /// Dispatches a message.
   bool send_message_on_behalf(core::object_t* sender,
                               std::unique_ptr<core::msg_t> msg) const;
@@ -278,17 +897,63 @@ private:
   core::object_t* object_{nullptr};
 };
 
+/**
+ * Result of a coroutine handler.
+ *
+ * A handler returning the task may co_await a future or a delay. The actor
+ * does not select other messages while the handler is suspended, so
+ * messages are still handled one at a time in the order of arrival.
+ * The message is kept until the handler completes. A coroutine handler
+ * cannot take the message by rvalue reference, as it may refer to
+ * a temporary copy destroyed at the first suspension.
+ * Each actor caches one frame of a completed handler, which is reused
+ * by the next handler of the actor if it fits.
+ */
+class task {
+public:
+  struct promise_type {
+    task get_return_object() const noexcept {
+      return task();
+    }
+
+    std::suspend_never initial_suspend() const noexcept {
+      return {};
+    }
+
+    /// The frame is destroyed as soon as the handler completes.
+    std::suspend_never final_suspend() const noexcept {
+      return {};
+    }
+
+    void return_void() const noexcept {
+    }
+
+    void unhandled_exception() const noexcept {
+      std::terminate();
+    }
+
+    static void* operator new(const size_t size) {
+      return core::allocate_frame(size);
+    }
+
+    static void operator delete(void* const ptr) noexcept {
+      core::deallocate_frame(ptr);
+    }
+  };
+};
+
 /**
  * Base class for all user-defined actors.
  */
 class actor {
   friend class core::runtime_t;
+  friend struct core::object_t;
 
   class handler_t {
   public:
     virtual ~handler_t() = default;
 
-    virtual void invoke(const std::unique_ptr<core::msg_t> msg) const = 0;
+    virtual void invoke(core::msg_t* const msg) const = 0;
   };
 
   template <typename F, typename M>
@@ -307,22 +972,47 @@ class actor {
                        core::msg_wrap_t<M>&&,
                        const core::msg_wrap_t<M>&>;
 
+  /// Calls the function with the value of the message passed as P.
+  template <typename M, typename P, typename F>
+  static void with_value(core::msg_t* const msg, F&& f) {
+    if (msg->shared) [[unlikely]] {
+      const M& value = static_cast<core::msg_shared_t*>(msg)->value<M>();
+      // The payload is shared with other actors, so a handler
+      // taking the value by rvalue reference gets a copy.
+      // Only copyable messages can be multicasted.
+      if constexpr (!std::is_rvalue_reference_v<P>) {
+        f(value);
+      } else if constexpr (std::is_copy_constructible_v<M>) {
+        f(M(value));
+      }
+    } else {
+      f(static_cast<message_reference_t<M, P>>(*msg).data());
+    }
+  }
+
+  /// Moves the reference to the sender from the message to the handler,
+  /// so the reference count is not touched on delivery.
+  static actor_ref take_sender(core::msg_t* const msg) noexcept {
+    return actor_ref(std::exchange(msg->sender, nullptr), false);
+  }
+
   /// Wrapper for member function pointers.
-  template <typename M, typename C, typename P>
+  template <typename M, typename C, typename P, typename R>
   class mem_handler_t final : public handler_t {
-    using F = std::function<void(C*, actor_ref, P)>;
+    using F = R (C::*)(actor_ref, P);
 
   public:
-    mem_handler_t(F&& func, C* ptr) noexcept
-      : func_(std::move(func))
+    mem_handler_t(const F func, C* ptr) noexcept
+      : func_(func)
       , ptr_(ptr) {
       assert(func_);
       assert(ptr_);
     }
 
-    void invoke(std::unique_ptr<core::msg_t> msg) const final {
-      func_(ptr_, actor_ref(msg->sender, true),
-            static_cast<message_reference_t<M, P>>(*msg.get()).data());
+    void invoke(core::msg_t* const msg) const final {
+      with_value<M, P>(msg, [&](auto&& value) {
+        (ptr_->*func_)(take_sender(msg), std::forward<decltype(value)>(value));
+      });
     }
 
   private:
@@ -331,41 +1021,47 @@ class actor {
   };
 
   /// Wrapper for functor objects.
-  template <typename M, typename... Args>
+  /// The functor is stored as is to let the compiler inline the call.
+  template <typename M, typename F, typename... Args>
   class fun_handler_t final : public handler_t {
-    using F = std::function<void(Args...)>;
-
   public:
-    fun_handler_t(F&& func) noexcept
-      : func_(std::move(func)) {
-      assert(func_);
+    template <typename T>
+    fun_handler_t(T&& func) noexcept(std::is_nothrow_constructible_v<F, T>)
+      : func_(std::forward<T>(func)) {
+      if constexpr (std::is_pointer_v<F>) {
+        assert(func_);
+      }
     }
 
-    void invoke(std::unique_ptr<core::msg_t> msg) const final {
+    void invoke(core::msg_t* const msg) const final {
       if constexpr (sizeof...(Args) == 0) {
         func_();
       } else if constexpr (sizeof...(Args) == 1) {
         using P0 = std::tuple_element_t<0, std::tuple<Args...>>;
 
         if constexpr (std::is_same_v<actor_ref, std::decay_t<P0>>) {
-          func_(actor_ref(msg->sender, true));
+          func_(take_sender(msg));
         } else {
-          func_(static_cast<message_reference_t<M, P0>>(*msg.get()).data());
+          with_value<M, P0>(msg, [this](auto&& value) {
+            func_(std::forward<decltype(value)>(value));
+          });
         }
       } else if constexpr (sizeof...(Args) == 2) {
         using P1 = std::tuple_element_t<1, std::tuple<Args...>>;
 
-        func_(actor_ref(msg->sender, true),
-              static_cast<message_reference_t<M, P1>>(*msg.get()).data());
+        with_value<M, P1>(msg, [&](auto&& value) {
+          func_(take_sender(msg), std::forward<decltype(value)>(value));
+        });
       }
     }
 
   private:
-    const F func_;
+    /// Mutable functors were allowed with std::function.
+    mutable F func_;
   };
 
 public:
-  virtual ~actor() noexcept = default;
+  virtual ~actor() noexcept;
 
 protected:
   actor_ref context() const {
@@ -382,15 +1078,31 @@ protected:
   /// Stops itself.
   void die() noexcept;
 
+  /// Limits the number of messages in the mailbox.
+  /// Takes effect only if called from the constructor.
+  void mailbox_capacity(
+    const size_t capacity,
+    const overflow_policy policy = overflow_policy::reject) noexcept {
+    capacity_ = capacity;
+    overflow_ = policy;
+  }
+
 public:
   /// Sets handler as member function pointer.
-  template <typename M, typename ClassName, typename P>
-  void handler(void (ClassName::*func)(actor_ref, P)) {
+  /// The function may be a coroutine returning task.
+  template <typename M, typename ClassName, typename P, typename R>
+  void handler(R (ClassName::*func)(actor_ref, P)) {
+    static_assert(std::is_void_v<R> || std::is_same_v<R, task>,
+                  "handler should return void or task");
+    static_assert(std::is_void_v<R> || !std::is_rvalue_reference_v<P>,
+                  "coroutine handler should not take the message by "
+                  "rvalue reference");
+
     set_handler(
       // Type of the handler.
-      std::type_index(typeid(M)),
+      core::type_id<M>(),
       // Callback.
-      std::make_unique<mem_handler_t<M, ClassName, P>>(
+      std::make_unique<mem_handler_t<M, ClassName, P, R>>(
         func, static_cast<ClassName*>(this)));
   }
 
@@ -399,75 +1111,100 @@ public:
             typename F,
             typename = std::enable_if_t<is_handler_signature<F, M>::value>>
   void handler(F&& func) {
+    using T = std::decay_t<F>;
+
     if constexpr (std::is_invocable_v<F>) {
       set_handler(
         // Type of the handler.
-        std::type_index(typeid(M)),
+        core::type_id<M>(),
         // Callback.
-        std::make_unique<fun_handler_t<M>>(std::move(func)));
+        std::make_unique<fun_handler_t<M, T>>(std::forward<F>(func)));
     } else if constexpr (std::is_invocable_v<F, const M&>) {
       set_handler(
         // Type of the handler.
-        std::type_index(typeid(M)),
+        core::type_id<M>(),
         // Callback.
-        std::make_unique<fun_handler_t<M, const M&>>(std::move(func)));
+        std::make_unique<fun_handler_t<M, T, const M&>>(
+          std::forward<F>(func)));
     } else if constexpr (std::is_invocable_v<F, M&&>) {
+      static_assert(!std::is_same_v<std::invoke_result_t<F, M&&>, task>,
+                    "coroutine handler should not take the message by "
+                    "rvalue reference");
       set_handler(
         // Type of the handler.
-        std::type_index(typeid(M)),
+        core::type_id<M>(),
         // Callback.
-        std::make_unique<fun_handler_t<M, M&&>>(std::move(func)));
+        std::make_unique<fun_handler_t<M, T, M&&>>(std::forward<F>(func)));
     } else if constexpr (std::is_invocable_v<F, actor_ref>) {
       set_handler(
         // Type of the handler.
-        std::type_index(typeid(M)),
+        core::type_id<M>(),
         // Callback.
-        std::make_unique<fun_handler_t<M, actor_ref>>(std::move(func)));
+        std::make_unique<fun_handler_t<M, T, actor_ref>>(
+          std::forward<F>(func)));
     } else if constexpr (std::is_invocable_v<F, actor_ref, const M&>) {
       set_handler(
         // Type of the handler.
-        std::type_index(typeid(M)),
+        core::type_id<M>(),
         // Callback.
-        std::make_unique<fun_handler_t<M, actor_ref, const M&>>(
-          std::move(func)));
+        std::make_unique<fun_handler_t<M, T, actor_ref, const M&>>(
+          std::forward<F>(func)));
     } else if constexpr (std::is_invocable_v<F, actor_ref, M&&>) {
+      static_assert(
+        !std::is_same_v<std::invoke_result_t<F, actor_ref, M&&>, task>,
+        "coroutine handler should not take the message by rvalue reference");
       set_handler(
         // Type of the handler.
-        std::type_index(typeid(M)),
+        core::type_id<M>(),
         // Callback.
-        std::make_unique<fun_handler_t<M, actor_ref, M&&>>(std::move(func)));
+        std::make_unique<fun_handler_t<M, T, actor_ref, M&&>>(
+          std::forward<F>(func)));
     }
   }
 
   /// Removes handler for the given type.
   template <typename M>
   void handler() {
-    set_handler(std::type_index(typeid(M)), nullptr);
+    set_handler(core::type_id<M>(), nullptr);
   }
 
   /// Removes handler for the given type.
   template <typename M>
   void handler(std::nullptr_t) {
-    set_handler(std::type_index(typeid(M)), nullptr);
+    set_handler(core::type_id<M>(), nullptr);
   }
 
 private:
   void consume_package(std::unique_ptr<core::msg_t> p);
 
-  void set_handler(const std::type_index& type, std::unique_ptr<handler_t> h);
+  /// Continues the suspended coroutine handler.
+  void resume();
+
+  void set_handler(const uint32_t type, std::unique_ptr<handler_t> h);
 
 private:
-  using handlers =
-    std::unordered_map<std::type_index, std::unique_ptr<handler_t>>;
+  using handlers = std::vector<std::unique_ptr<handler_t>>;
 
   /// Reference to parent object. Can be null.
   actor_ref context_;
   /// Reference to itself.
   actor_ref self_;
-  /// List of message handlers.
+  /// Message handlers indexed by type id relative to handlers_base_.
   handlers handlers_;
+  /// Type id of the first slot of the handlers table.
+  uint32_t handlers_base_{0};
+  /// Maximum number of messages in the mailbox.
+  size_t capacity_{0};
+  /// Behavior of the mailbox when it is full.
+  overflow_policy overflow_{overflow_policy::reject};
   /// Object in terminating state.
   bool terminating_{false};
+  /// Suspended coroutine handler.
+  std::coroutine_handle<> awaiting_;
+  /// Message of the suspended handler.
+  std::unique_ptr<core::msg_t> awaiting_msg_;
+  /// The only frame of a completed coroutine handler kept for reuse.
+  void* frame_cache_{nullptr};
 };
 
 /**
@@ -489,24 +1226,141 @@ void destroy_and_wait(const actor_ref& object);
  */
 void join(const actor_ref& obj);
 
+/**
+ * Sends the message to all the actors.
+ *
+ * The message is constructed once and shared by all recipients, which
+ * receive it by const reference. Handlers taking the message by rvalue
+ * reference get a copy. Recipients woken by the call are scheduled
+ * at once.
+ * @return number of actors the message has been placed into mailboxes of.
+ */
+template <typename Msg>
+size_t multicast(std::span<const actor_ref> targets, Msg&& msg) {
+  using T = std::remove_cvref_t<Msg>;
+
+  static_assert(std::is_copy_constructible_v<T>,
+                "multicast message should be copy constructible");
+
+  return core::multicast(
+    targets, new core::shared_value_t<T>(std::forward<Msg>(msg)),
+    core::type_id<T>());
+}
+
+/**
+ * Creates a router spreading messages over the routees.
+ *
+ * A message sent to the router is placed directly into the mailbox of
+ * the selected routee. A batch is sent to a single routee selected by
+ * the first message of the batch. The router holds references to the
+ * routees until the last reference to the router is dropped.
+ * Messages sent to a router without routees or to a destroyed router
+ * are rejected.
+ */
+actor_ref make_router(const routing_strategy strategy,
+                      std::vector<actor_ref> routees,
+                      routing_keys keys = routing_keys());
+
 /**
  * Stops all actors.
  */
 void shutdown();
 
+/**
+ * Sets parameters of the default runtime.
+ *
+ * Should be called before first use of the library.
+ * @return false if the runtime has already been started.
+ */
+bool configure(const runtime_config& config);
+
 namespace core {
 
 object_t* make_instance(actor_ref context,
                         const actor_thread thread_opt,
+                        const actor_priority priority,
+                        std::unique_ptr<actor> body);
+
+object_t* make_instance(runtime& rt,
+                        actor_ref context,
+                        const actor_thread thread_opt,
+                        const actor_priority priority,
                         std::unique_ptr<actor> body);
 
+/// Converts a pointer to the body placed into an arena to the actor.
+using body_cast_t = actor* (*)(void*) noexcept;
+
+/**
+ * Creates objects for all bodies placed into the arena and appends
+ * references to them to the result.
+ *
+ * The runtime of the current context is used if none is given.
+ */
+void make_instances(runtime* const rt,
+                    arena_t* const arena,
+                    const body_cast_t cast,
+                    std::vector<actor_ref>& result);
+
+/**
+ * Marks the current worker thread as blocked for the lifetime of the guard.
+ */
+class blocking_guard {
+public:
+  blocking_guard();
+  ~blocking_guard();
+
+  blocking_guard(const blocking_guard&) = delete;
+  blocking_guard& operator=(const blocking_guard&) = delete;
+
+private:
+  /// Runtime which has been notified about the blocked worker.
+  runtime_t* const runtime_;
+};
+
 } // namespace core
 
+/**
+ * Independent instance of the runtime with its own pool of workers.
+ *
+ * Actors spawned from a handler are placed into the runtime of the
+ * active actor unless a runtime is given explicitly.
+ * Actors of different runtimes may freely send messages to each other.
+ */
+class runtime {
+  friend core::object_t* core::make_instance(runtime&,
+                                             actor_ref,
+                                             const actor_thread,
+                                             const actor_priority,
+                                             std::unique_ptr<actor>);
+  friend void core::make_instances(runtime* const,
+                                   arena_t* const,
+                                   const core::body_cast_t,
+                                   std::vector<actor_ref>&);
+
+public:
+  explicit runtime(const runtime_config& config = runtime_config());
+
+  /// Stops all actors and worker threads of the runtime.
+  ~runtime();
+
+  runtime(const runtime&) = delete;
+  runtime& operator=(const runtime&) = delete;
+
+public:
+  /// Stops all actors of the runtime.
+  void shutdown();
+
+private:
+  core::runtime_t* const impl_;
+};
+
+
 template <typename T, typename... P>
 inline std::enable_if_t<std::is_base_of<::acto::actor, T>::value, actor_ref>
 spawn(P&&... p) {
   return actor_ref(
     core::make_instance(actor_ref(), actor_thread::shared,
+                        actor_priority::normal,
                         std::make_unique<T>(std::forward<P>(p)...)),
     false);
 }
@@ -516,6 +1370,7 @@ inline std::enable_if_t<std::is_base_of<::acto::actor, T>::value, actor_ref>
 spawn(actor_ref context, P&&... p) {
   return actor_ref(
     core::make_instance(std::move(context), actor_thread::shared,
+                        actor_priority::normal,
                         std::make_unique<T>(std::forward<P>(p)...)),
     false);
 }
@@ -525,6 +1380,7 @@ inline std::enable_if_t<std::is_base_of<::acto::actor, T>::value, actor_ref>
 spawn(const actor_thread thread_opt, P&&... p) {
   return actor_ref(
     core::make_instance(actor_ref(), thread_opt,
+                        actor_priority::normal,
                         std::make_unique<T>(std::forward<P>(p)...)),
     false);
 }
@@ -534,19 +1390,481 @@ inline std::enable_if_t<std::is_base_of<::acto::actor, T>::value, actor_ref>
 spawn(actor_ref context, const actor_thread thread_opt, P&&... p) {
   return actor_ref(
     core::make_instance(std::move(context), thread_opt,
+                        actor_priority::normal,
+                        std::make_unique<T>(std::forward<P>(p)...)),
+    false);
+}
+
+template <typename T, typename... P>
+inline std::enable_if_t<std::is_base_of<::acto::actor, T>::value, actor_ref>
+spawn(runtime& rt, P&&... p) {
+  return actor_ref(
+    core::make_instance(rt, actor_ref(), actor_thread::shared,
+                        actor_priority::normal,
+                        std::make_unique<T>(std::forward<P>(p)...)),
+    false);
+}
+
+template <typename T, typename... P>
+inline std::enable_if_t<std::is_base_of<::acto::actor, T>::value, actor_ref>
+spawn(runtime& rt, actor_ref context, P&&... p) {
+  return actor_ref(
+    core::make_instance(rt, std::move(context), actor_thread::shared,
+                        actor_priority::normal,
                         std::make_unique<T>(std::forward<P>(p)...)),
     false);
 }
 
+template <typename T, typename... P>
+inline std::enable_if_t<std::is_base_of<::acto::actor, T>::value, actor_ref>
+spawn(runtime& rt, const actor_thread thread_opt, P&&... p) {
+  return actor_ref(
+    core::make_instance(rt, actor_ref(), thread_opt,
+                        actor_priority::normal,
+                        std::make_unique<T>(std::forward<P>(p)...)),
+    false);
+}
+
+template <typename T, typename... P>
+inline std::enable_if_t<std::is_base_of<::acto::actor, T>::value, actor_ref>
+spawn(runtime& rt,
+      actor_ref context,
+      const actor_thread thread_opt,
+      P&&... p) {
+  return actor_ref(
+    core::make_instance(rt, std::move(context), thread_opt,
+                        actor_priority::normal,
+                        std::make_unique<T>(std::forward<P>(p)...)),
+    false);
+}
+
+template <typename T, typename... P>
+inline std::enable_if_t<std::is_base_of<::acto::actor, T>::value, actor_ref>
+spawn(const actor_priority priority, P&&... p) {
+  return actor_ref(
+    core::make_instance(actor_ref(), actor_thread::shared, priority,
+                        std::make_unique<T>(std::forward<P>(p)...)),
+    false);
+}
+
+template <typename T, typename... P>
+inline std::enable_if_t<std::is_base_of<::acto::actor, T>::value, actor_ref>
+spawn(actor_ref context, const actor_priority priority, P&&... p) {
+  return actor_ref(
+    core::make_instance(std::move(context), actor_thread::shared, priority,
+                        std::make_unique<T>(std::forward<P>(p)...)),
+    false);
+}
+
+template <typename T, typename... P>
+inline std::enable_if_t<std::is_base_of<::acto::actor, T>::value, actor_ref>
+spawn(runtime& rt, const actor_priority priority, P&&... p) {
+  return actor_ref(
+    core::make_instance(rt, actor_ref(), actor_thread::shared, priority,
+                        std::make_unique<T>(std::forward<P>(p)...)),
+    false);
+}
+
+template <typename T, typename... P>
+inline std::enable_if_t<std::is_base_of<::acto::actor, T>::value, actor_ref>
+spawn(runtime& rt,
+      actor_ref context,
+      const actor_priority priority,
+      P&&... p) {
+  return actor_ref(
+    core::make_instance(rt, std::move(context), actor_thread::shared,
+                        priority,
+                        std::make_unique<T>(std::forward<P>(p)...)),
+    false);
+}
+
+namespace core {
+
+template <typename T, typename... P>
+std::vector<actor_ref> spawn_n(runtime* const rt,
+                               const size_t count,
+                               P&... p) {
+  std::vector<actor_ref> result;
+
+  if (count == 0) {
+    return result;
+  }
+  result.reserve(count);
+
+  arena_t* const arena = make_arena(count, sizeof(T), alignof(T));
+  size_t i = 0;
+
+  try {
+    for (; i < count; ++i) {
+      new (arena->body(i)) T(p...);
+    }
+  } catch (...) {
+    while (i) {
+      static_cast<T*>(arena->body(--i))->~T();
+    }
+    delete_arena(arena);
+    throw;
+  }
+
+  make_instances(
+    rt, arena,
+    [](void* const body) noexcept -> actor* { return static_cast<T*>(body); },
+    result);
+
+  return result;
+}
+
+} // namespace core
+
+/**
+ * Spawns the given number of actors of the same type at once.
+ *
+ * Each actor is constructed from the same arguments passed as lvalues,
+ * so the arguments are never moved from.
+ * Core objects and bodies of the actors are placed into a single block
+ * of memory and registered in the runtime at once, which is much cheaper
+ * than spawning the actors one by one.
+ */
+template <typename T, typename... P>
+inline std::enable_if_t<std::is_base_of<::acto::actor, T>::value,
+                        std::vector<actor_ref>>
+spawn_n(const size_t count, P&&... p) {
+  return core::spawn_n<T>(nullptr, count, p...);
+}
+
+template <typename T, typename... P>
+inline std::enable_if_t<std::is_base_of<::acto::actor, T>::value,
+                        std::vector<actor_ref>>
+spawn_n(runtime& rt, const size_t count, P&&... p) {
+  return core::spawn_n<T>(&rt, count, p...);
+}
+
+/**
+ * Runs a function which may block the calling thread for a long time,
+ * e.g. a synchronous I/O call or waiting on a lock.
+ *
+ * If called from a handler of an actor in the shared pool, the worker is
+ * immediately excluded from the pool, so the scheduler may start or
+ * borrow a compensating worker to serve other actors in the meantime.
+ * The pool shrinks back after the function returns.
+ */
+template <typename F>
+inline decltype(auto) blocking(F&& f) {
+  core::blocking_guard guard;
+
+  return std::forward<F>(f)();
+}
+
+/**
+ * Result of a request sent with ask().
+ */
+template <typename T>
+class future {
+public:
+  constexpr future() noexcept = default;
+
+  explicit future(core::reply_t* const slot) noexcept
+    : slot_(slot) {
+  }
+
+  future(future&& rhs) noexcept
+    : slot_(std::exchange(rhs.slot_, nullptr)) {
+  }
+
+  future(const future&) = delete;
+  future& operator=(const future&) = delete;
+
+  ~future() {
+    if (slot_) {
+      slot_->release();
+    }
+  }
+
+  future& operator=(future&& rhs) noexcept {
+    if (this != &rhs) {
+      if (slot_) {
+        slot_->release();
+      }
+      slot_ = std::exchange(rhs.slot_, nullptr);
+    }
+    return *this;
+  }
+
+public:
+  /// Whether the future refers to a request.
+  bool valid() const noexcept {
+    return slot_ != nullptr;
+  }
+
+  /// Whether the request has been completed either with a reply or
+  /// without one.
+  bool ready() const noexcept {
+    return slot_ && slot_->state.load() > core::reply_t::CLAIMED;
+  }
+
+  /// Waits until the request is completed.
+  void wait() const {
+    if (slot_ && !ready()) {
+      core::blocking_guard guard;
+
+      slot_->done.wait();
+    }
+  }
+
+  /// Waits until the request is completed or the timeout expires.
+  /// @return true if the request has been completed.
+  template <typename Rep, typename Period>
+  bool wait_for(const std::chrono::duration<Rep, Period> timeout) const {
+    if (slot_ && !ready()) {
+      core::blocking_guard guard;
+
+      slot_->done.wait(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(timeout));
+    }
+    return ready();
+  }
+
+  /// Waits for the reply.
+  /// @return empty value if no reply will arrive or it has been taken.
+  std::optional<T> get() {
+    wait();
+    return take();
+  }
+
+  /// Waits for the reply up to the timeout.
+  /// @return empty value if the reply has not arrived in time.
+  template <typename Rep, typename Period>
+  std::optional<T> get_for(const std::chrono::duration<Rep, Period> timeout) {
+    wait_for(timeout);
+    return take();
+  }
+
+  /// Suspends the coroutine handler until the request is completed.
+  /// The result is the same as of get().
+  auto operator co_await() noexcept {
+    struct awaiter {
+      future* const self;
+
+      bool await_ready() const noexcept {
+        return !self->slot_ || self->ready();
+      }
+
+      bool await_suspend(const std::coroutine_handle<> h) const {
+        return core::await_reply(self->slot_, h);
+      }
+
+      std::optional<T> await_resume() const {
+        return self->take();
+      }
+    };
+
+    return awaiter{this};
+  }
+
+private:
+  std::optional<T> take() {
+    if (!slot_ || slot_->state.load() != core::reply_t::REPLIED) {
+      return std::nullopt;
+    }
+
+    std::unique_ptr<core::msg_t> msg(std::exchange(slot_->msg, nullptr));
+
+    if (!msg) {
+      return std::nullopt;
+    }
+    if (msg->shared) {
+      if constexpr (std::is_copy_constructible_v<T>) {
+        return core::message_value<T>(msg.get());
+      } else {
+        return std::nullopt;
+      }
+    }
+    return std::move(*static_cast<core::msg_wrap_t<T>*>(msg.get())).data();
+  }
+
+private:
+  core::reply_t* slot_{nullptr};
+};
+
+/**
+ * Sends the message to the actor and returns the future of the reply.
+ *
+ * The reply is a message of the given type sent back to the sender of
+ * the request. It is stored in the future directly, no actor is spawned
+ * to receive it. The future completes without a reply if the request is
+ * rejected or the actor drops all references to the sender without
+ * replying.
+ * Waiting inside a handler blocks the worker, so it is excluded from the
+ * pool for the time of waiting.
+ */
+template <typename Reply, typename Msg>
+future<Reply> ask(const actor_ref& target, Msg&& msg) {
+  return future<Reply>(core::ask(
+    target,
+    std::make_unique<core::msg_wrap_t<std::remove_cvref_t<Msg>>>(
+      std::forward<Msg>(msg)),
+    core::type_id<Reply>()));
+}
+
+/**
+ * Suspends the coroutine handler for the given time.
+ *
+ * The actor does not handle other messages meanwhile, but the worker
+ * is not blocked. Outside of handlers the calling thread sleeps.
+ * Pending delays expire at once when the runtime is shut down.
+ */
+template <typename Rep, typename Period>
+auto delay(const std::chrono::duration<Rep, Period> duration) noexcept {
+  struct awaiter {
+    const std::chrono::steady_clock::duration duration;
+
+    bool await_ready() const noexcept {
+      return duration <= std::chrono::steady_clock::duration::zero();
+    }
+
+    bool await_suspend(const std::coroutine_handle<> h) const {
+      return core::await_delay(std::chrono::steady_clock::now() + duration,
+                               h);
+    }
+
+    void await_resume() const noexcept {
+    }
+  };
+
+  return awaiter{
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      duration)};
+}
+
+/**
+ * Handle of a delayed or periodic message.
+ *
+ * Dropping the handle does not cancel the timer.
+ */
+class timer {
+public:
+  constexpr timer() noexcept = default;
+
+  explicit timer(core::timer_entry_t* const entry) noexcept
+    : entry_(entry) {
+  }
+
+  timer(timer&& rhs) noexcept
+    : entry_(std::exchange(rhs.entry_, nullptr)) {
+  }
+
+  timer(const timer&) = delete;
+
+  ~timer() {
+    if (entry_) {
+      core::release_timer(entry_);
+    }
+  }
+
+  timer& operator=(timer&& rhs) noexcept {
+    if (this != &rhs) {
+      if (entry_) {
+        core::release_timer(entry_);
+      }
+      entry_ = std::exchange(rhs.entry_, nullptr);
+    }
+    return *this;
+  }
+
+  timer& operator=(const timer&) = delete;
+
+  /// Cancels the timer.
+  /// @return false if the message of a one-shot timer has been sent
+  ///         already or the timer has been cancelled before.
+  bool cancel() {
+    return entry_ && core::cancel_timer(entry_);
+  }
+
+  /// The handle refers to a timer.
+  bool valid() const noexcept {
+    return entry_ != nullptr;
+  }
+
+private:
+  core::timer_entry_t* entry_{nullptr};
+};
+
+/**
+ * Sends the message to the actor after the delay.
+ *
+ * The message is sent on behalf of no actor. Timers are kept in a timing
+ * wheel of the runtime of the target, so neither setting nor cancelling
+ * a timer depends on the number of pending ones. The delay is rounded up
+ * to the tick of the wheel (runtime_config::timer_tick).
+ */
+template <typename Rep, typename Period, typename Msg>
+timer send_after(const actor_ref& target,
+                 const std::chrono::duration<Rep, Period> delay,
+                 Msg&& msg) {
+  return timer(core::send_after(
+    target, std::chrono::duration_cast<std::chrono::nanoseconds>(delay),
+    std::make_unique<core::msg_wrap_t<std::remove_cvref_t<Msg>>>(
+      std::forward<Msg>(msg))));
+}
+
+/**
+ * Sends the message to the actor every period until the timer is
+ * cancelled or the actor is destroyed.
+ *
+ * The message is constructed once and shared by all deliveries as with
+ * multicast(). A delivery is skipped if the mailbox of the actor is full.
+ */
+template <typename Rep, typename Period, typename Msg>
+timer send_every(const actor_ref& target,
+                 const std::chrono::duration<Rep, Period> period,
+                 Msg&& msg) {
+  using T = std::remove_cvref_t<Msg>;
+
+  static_assert(std::is_copy_constructible_v<T>,
+                "periodic message should be copy constructible");
+
+  return timer(core::send_every(
+    target, std::chrono::duration_cast<std::chrono::nanoseconds>(period),
+    new core::shared_value_t<T>(std::forward<Msg>(msg)), core::type_id<T>()));
+}
+
 namespace this_thread {
 
 /**
- * Processes all messages for objects
- * binded to the current thread (with aoBindToThread option).
+ * Limits of a call to process_messages().
+ * Zero means there is no limit.
+ */
+struct process_budget {
+  /// Maximum number of messages to handle.
+  size_t messages{0};
+  /// Time after which no more messages are handled. A running handler
+  /// is never interrupted, so the call may last longer by the time of
+  /// the handler.
+  std::chrono::nanoseconds time{0};
+};
+
+/**
+ * Gives each actor bound to the current thread a turn to handle
+ * the messages it had received before the turn began.
+ *
+ * Messages sent to the actors during the call, including the ones sent
+ * by the actors to themselves, are left for the next call.
  * @return true if at least one message has been processed.
  */
 bool process_messages();
 
+/**
+ * Handles messages of the actors bound to the current thread until
+ * there are no messages left or the budget is exhausted.
+ *
+ * Actors take turns in round-robin order, each turn is limited by
+ * the messages received before the turn began, so an actor which keeps
+ * sending messages to itself does not starve the others. The next call
+ * starts from the actor following the last one served.
+ * @return true if at least one message has been processed.
+ */
+bool process_messages(const process_budget& budget);
+
 template <typename D>
 inline void sleep_for(const D duration) {
   std::this_thread::sleep_for(duration);
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
-#include <condition_variable>
-#include <mutex>
+#include <cstdint>
+
+#if !defined(__linux__)
+# include <condition_variable>
+# include <mutex>
+#endif
 
 namespace acto::core {
 
@@ -12,9 +17,18 @@ enum class wait_result {
   timeout,
 };
 
+/**
+ * Parking primitive.
+ *
+ * Signaling the event is lock-free and does not make a system call while
+ * nobody sleeps on it. Waiting threads may spin for a while before
+ * parking. On Linux the threads are parked with futex, other platforms
+ * fall back to a condition variable.
+ */
 class event {
 public:
-  explicit event(const bool auto_reset = false);
+  explicit event(const bool auto_reset = false,
+                 const std::chrono::nanoseconds spin = {});
 
 public:
   void reset();
@@ -25,11 +39,29 @@ public:
 
   wait_result wait(const std::chrono::nanoseconds duration);
 
+  /// Sets duration of spinning before the thread will be parked.
+  void set_spin(const std::chrono::nanoseconds spin) noexcept {
+    spin_ = spin;
+  }
+
+private:
+  /// Consumes the signaled state.
+  bool try_acquire() noexcept;
+
+  /// Spins up to the configured duration awaiting for the signaled state.
+  bool spin_wait() noexcept;
+
+  wait_result park(const std::chrono::steady_clock::time_point* deadline);
+
 private:
+  /// Signaled flag and number of parked threads.
+  std::atomic<uint32_t> state_{0};
+  const bool auto_;
+  std::chrono::nanoseconds spin_;
+#if !defined(__linux__)
   std::mutex mutex_;
   std::condition_variable cond_;
-  bool auto_;
-  bool triggered_;
+#endif
 };
 
 } // namespace acto::core
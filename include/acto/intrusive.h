@@ -155,10 +155,40 @@ public:
     } while (true);
   }
 
+  /// Pushes items of the sequence as if they were pushed one by one.
   void push(sequence<T>&& seq) noexcept {
-    while (T* const item = seq.pop()) {
-      this->push(item);
+    T* first = nullptr;
+    T* last = nullptr;
+    // Reverse the sequence locally.
+    while (T* const item = seq.pop_front()) {
+      item->next = first;
+      first = item;
+      if (!last) {
+        last = item;
+      }
     }
+    if (first) {
+      this->push(first, last);
+    }
+  }
+
+  /// Pushes the linked chain of items with a single atomic operation.
+  /// The first item becomes the top of the stack.
+  void push(T* const first, T* const last) noexcept {
+    do {
+      T* top = head_.load(std::memory_order_relaxed);
+      last->next = top;
+      if (head_.compare_exchange_weak(top, first)) {
+        return;
+      }
+    } while (true);
+  }
+
+  /// Returns the top of the stack without extracting it.
+  /// Items below the top are not modified by producers, so the consumer
+  /// can walk them.
+  T* top() const noexcept {
+    return head_.load(std::memory_order_acquire);
   }
 
   T* pop() noexcept {
@@ -229,4 +259,50 @@ private:
   T* head_{nullptr};
 };
 
+/**
+ * Stack protected by a lock.
+ * Can be safely used by multiple producers and multiple consumers.
+ */
+template <typename T, typename Mutex = spin_lock>
+class locked_stack {
+public:
+  /// Checks the stack is empty without taking the lock.
+  bool empty() const noexcept {
+    return size_.load(std::memory_order_relaxed) == 0;
+  }
+
+  sequence<T> extract() {
+    std::lock_guard g(mutex_);
+
+    size_.store(0, std::memory_order_relaxed);
+    return stack_.extract();
+  }
+
+  void push(T* const node) {
+    std::lock_guard g(mutex_);
+
+    stack_.push(node);
+    size_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  T* pop() {
+    if (empty()) {
+      return nullptr;
+    }
+
+    std::lock_guard g(mutex_);
+
+    T* const result = stack_.pop();
+    if (result) {
+      size_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return result;
+  }
+
+private:
+  stack<T> stack_;
+  std::atomic<unsigned long> size_{0};
+  Mutex mutex_;
+};
+
 } // namespace acto::intrusive
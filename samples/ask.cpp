@@ -0,0 +1,117 @@
+///////////////////////////////////////////////////////////////////////////////
+// Desc:                                                                     //
+//    The sample measures the cost of a request/response round trip from    //
+//    a thread not managed by the library:                                   //
+//      - helper : the reply is received by an actor bound to the thread,    //
+//                 which is polled with process_messages();                  //
+//      - ask    : the reply is received with acto::ask();                   //
+//      - window : a window of asks is kept in flight.                       //
+//                                                                           //
+//    Usage: ask [requests]                                                  //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#include <acto/acto.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+
+// Number of asks in flight.
+static constexpr size_t WINDOW = 64;
+
+struct msg_request {
+  unsigned long value;
+};
+
+struct msg_response {
+  unsigned long value;
+};
+
+// Desc: Replies to requests.
+class Server : public acto::actor {
+public:
+  Server() {
+    actor::handler<msg_request>(
+      [](acto::actor_ref sender, const msg_request& m) {
+        sender.send(msg_response{m.value + 1});
+      });
+  }
+};
+
+// Desc: Receives a reply and forwards the request on its behalf.
+class Helper : public acto::actor {
+public:
+  Helper(acto::actor_ref server, unsigned long& result) {
+    actor::handler<msg_response>(
+      [&result](const msg_response& m) { result = m.value; });
+    actor::handler<msg_request>([server](const msg_request& m) {
+      server.send(m);
+    });
+  }
+};
+
+template <typename F>
+static void measure(const char* name, const unsigned long count, F&& f) {
+  const auto start = std::chrono::steady_clock::now();
+  unsigned long sum = 0;
+
+  for (unsigned long i = 0; i < count; ++i) {
+    sum += f(i);
+  }
+
+  const std::chrono::duration<double, std::nano> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  std::printf("%-8s %10.2f ns/request (:%lu)\n", name,
+              elapsed.count() / double(count), sum % 2);
+}
+
+int main(int argc, char* argv[]) {
+  const unsigned long count =
+    (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 1000000ul;
+  const auto server = acto::spawn<Server>();
+
+  std::printf("Requests : %lu\n\n", count);
+
+  unsigned long result = 0;
+  const auto helper =
+    acto::spawn<Helper>(acto::actor_thread::bind, server, result);
+
+  measure("helper", count, [&](unsigned long i) {
+    result = 0;
+    helper.send(msg_request{i});
+    while (result == 0) {
+      acto::this_thread::process_messages();
+    }
+    return result;
+  });
+
+  measure("ask", count, [&](unsigned long i) {
+    return acto::ask<msg_response>(server, msg_request{i}).get()->value;
+  });
+
+  std::deque<acto::future<msg_response>> futures;
+
+  measure("window", count, [&](unsigned long i) -> unsigned long {
+    futures.push_back(acto::ask<msg_response>(server, msg_request{i}));
+    if (futures.size() < WINDOW && i + 1 < count) {
+      return 0;
+    }
+
+    unsigned long sum = 0;
+    while (!futures.empty()) {
+      sum += futures.front().get()->value;
+      futures.pop_front();
+    }
+    return sum;
+  });
+
+  acto::destroy(helper);
+  acto::destroy(server);
+  acto::this_thread::process_messages();
+  acto::shutdown();
+
+  return 0;
+}
@@ -0,0 +1,117 @@
+///////////////////////////////////////////////////////////////////////////////
+// Desc:                                                                     //
+//    The sample compares two ways for a handler to wait for a reply to     //
+//    a request sent with acto::ask():                                       //
+//      - get      : the handler blocks the worker until the reply arrives;  //
+//      - co_await : the handler is a coroutine, which is suspended until    //
+//                   the reply arrives, so the worker serves other actors.   //
+//    Many clients make a series of requests to a single server at once.     //
+//    The time per request is printed for each way.                         //
+//                                                                           //
+//    Usage: await [clients] [requests]                                      //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#include <acto/acto.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+struct msg_request {
+  unsigned long value;
+};
+
+struct msg_response {
+  unsigned long value;
+};
+
+struct msg_start { };
+
+// Desc: Replies to requests.
+class Server : public acto::actor {
+public:
+  Server() {
+    actor::handler<msg_request>(
+      [](acto::actor_ref sender, const msg_request& m) {
+        sender.send(msg_response{m.value + 1});
+      });
+  }
+};
+
+// Desc: Waits for replies by blocking the worker.
+class BlockingClient : public acto::actor {
+public:
+  BlockingClient(const unsigned int requests, std::atomic<unsigned>& done) {
+    actor::handler<msg_start>([this, requests, &done] {
+      for (unsigned int i = 0; i < requests; ++i) {
+        acto::ask<msg_response>(actor::context(), msg_request{i}).get();
+      }
+      done.fetch_add(1);
+    });
+  }
+};
+
+// Desc: Waits for replies by suspending the handler.
+class CoroutineClient : public acto::actor {
+public:
+  CoroutineClient(const unsigned int requests, std::atomic<unsigned>& done) {
+    actor::handler<msg_start>([this, requests, &done]() -> acto::task {
+      for (unsigned int i = 0; i < requests; ++i) {
+        co_await acto::ask<msg_response>(actor::context(), msg_request{i});
+      }
+      done.fetch_add(1);
+    });
+  }
+};
+
+template <typename Client>
+static void measure(const char* name,
+                    const unsigned int clients,
+                    const unsigned int requests) {
+  std::atomic<unsigned> done{0};
+  std::vector<acto::actor_ref> actors;
+  const auto server = acto::spawn<Server>();
+
+  for (unsigned int i = 0; i < clients; ++i) {
+    actors.push_back(acto::spawn<Client>(server, requests, done));
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+
+  for (const auto& actor : actors) {
+    actor.send(msg_start{});
+  }
+  while (done.load() < clients) {
+    std::this_thread::yield();
+  }
+
+  const std::chrono::duration<double, std::micro> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  std::printf("%-10s %8.2f us/request\n", name,
+              elapsed.count() / double(clients * requests));
+
+  for (const auto& actor : actors) {
+    acto::destroy(actor);
+  }
+  acto::destroy(server);
+  acto::shutdown();
+}
+
+int main(int argc, char* argv[]) {
+  const unsigned int clients = (argc > 1) ? unsigned(std::atoi(argv[1])) : 2u;
+  const unsigned int requests =
+    (argc > 2) ? unsigned(std::atoi(argv[2])) : 100u;
+
+  std::printf("Clients  : %u\n", clients);
+  std::printf("Requests : %u\n\n", requests);
+
+  measure<BlockingClient>("get", clients, requests);
+  measure<CoroutineClient>("co_await", clients, requests);
+
+  return 0;
+}
@@ -0,0 +1,92 @@
+///////////////////////////////////////////////////////////////////////////////
+// Desc:                                                                     //
+//    The sample compares two ways of sending the same message to many      //
+//    actors:                                                                //
+//      - send      : a copy of the message is sent to each actor;           //
+//      - multicast : a single shared payload is sent to all actors.         //
+//    The message carries a table of a few kilobytes to show the cost of     //
+//    copying. The time per recipient includes handling of the message.     //
+//                                                                           //
+//    Usage: broadcast [recipients] [rounds]                                 //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#include <acto/acto.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+struct msg_table {
+  std::vector<int> rows;
+};
+
+// Desc: Reads the first row of the table.
+class Reader : public acto::actor {
+public:
+  Reader(std::atomic<unsigned long>& handled) {
+    actor::handler<msg_table>([&handled](const msg_table& m) {
+      if (!m.rows.empty()) {
+        handled.fetch_add(1, std::memory_order_relaxed);
+      }
+    });
+  }
+};
+
+template <typename F>
+static void measure(const char* name,
+                    const std::vector<acto::actor_ref>& readers,
+                    std::atomic<unsigned long>& handled,
+                    const unsigned int rounds,
+                    F&& f) {
+  const unsigned long expected = handled.load() + readers.size() * rounds;
+  const auto start = std::chrono::steady_clock::now();
+
+  for (unsigned int i = 0; i < rounds; ++i) {
+    f(msg_table{std::vector<int>(1024, int(i))});
+  }
+  while (handled.load() < expected) {
+    std::this_thread::yield();
+  }
+
+  const std::chrono::duration<double, std::nano> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  std::printf("%-12s %8.2f ns/recipient\n", name,
+              elapsed.count() / double(readers.size() * rounds));
+}
+
+int main(int argc, char* argv[]) {
+  const unsigned int count =
+    (argc > 1) ? unsigned(std::atoi(argv[1])) : 10000u;
+  const unsigned int rounds = (argc > 2) ? unsigned(std::atoi(argv[2])) : 100u;
+  std::atomic<unsigned long> handled{0};
+  std::vector<acto::actor_ref> readers;
+
+  for (unsigned int i = 0; i < count; ++i) {
+    readers.push_back(acto::spawn<Reader>(handled));
+  }
+
+  std::printf("Recipients : %u\n", count);
+  std::printf("Rounds     : %u\n\n", rounds);
+
+  measure("send", readers, handled, rounds, [&](const msg_table& msg) {
+    for (const auto& reader : readers) {
+      reader.send(msg);
+    }
+  });
+
+  measure("multicast", readers, handled, rounds, [&](msg_table&& msg) {
+    acto::multicast(readers, std::move(msg));
+  });
+
+  for (const auto& reader : readers) {
+    acto::destroy(reader);
+  }
+  acto::shutdown();
+
+  return 0;
+}
@@ -0,0 +1,186 @@
+///////////////////////////////////////////////////////////////////////////////
+// Desc:                                                                     //
+//    The sample measures the cost of selecting a handler for a message.     //
+//                                                                           //
+//    Two dispatch schemes are compared on the same set of handlers:         //
+//      - map   : std::unordered_map keyed by std::type_index;               //
+//      - table : flat table indexed by dense type ids (acto::core::type_id).//
+//    Both call handlers through a virtual function and std::function, so    //
+//    only the lookup differs.                                               //
+//                                                                           //
+//    Then the cost of delivering a message to an actor bound to the thread  //
+//    is printed for each supported signature of a handler.                  //
+//                                                                           //
+//    Usage: dispatch [iterations]                                           //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#include <acto/acto.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+// Number of message types.
+static constexpr size_t TYPES = 8;
+
+template <size_t N>
+struct msg_tag {
+  int value;
+};
+
+// Message as seen by a dispatcher.
+struct envelope_t {
+  std::type_index index;
+  uint32_t id;
+  int value;
+};
+
+class handler_t {
+public:
+  virtual ~handler_t() = default;
+
+  virtual void invoke(const envelope_t& msg) const = 0;
+};
+
+class fun_handler_t final : public handler_t {
+public:
+  fun_handler_t(std::function<void(int)> func)
+    : func_(std::move(func)) {
+  }
+
+  void invoke(const envelope_t& msg) const final {
+    func_(msg.value);
+  }
+
+private:
+  const std::function<void(int)> func_;
+};
+
+static long long counter = 0;
+
+template <size_t... N>
+static std::vector<envelope_t> make_messages(std::index_sequence<N...>) {
+  return {envelope_t{typeid(msg_tag<N>), acto::core::type_id<msg_tag<N>>(),
+                     int(N)}...};
+}
+
+template <typename F>
+static double measure(const char* name, const size_t iterations, F&& f) {
+  const auto start = std::chrono::steady_clock::now();
+
+  f();
+
+  const std::chrono::duration<double, std::nano> elapsed =
+    std::chrono::steady_clock::now() - start;
+  const double result = elapsed.count() / double(iterations);
+
+  std::printf("%-24s %8.2f ns/msg\n", name, result);
+  return result;
+}
+
+// Desc: Handles each message type with a handler of different signature.
+class Signatures : public acto::actor {
+public:
+  Signatures() {
+    actor::handler<msg_tag<0>>(&Signatures::do_member);
+    actor::handler<msg_tag<1>>([] { counter += 1; });
+    actor::handler<msg_tag<2>>([](const msg_tag<2>& m) { counter += m.value; });
+    actor::handler<msg_tag<3>>([](msg_tag<3>&& m) { counter += m.value; });
+    actor::handler<msg_tag<4>>([](acto::actor_ref) { counter += 1; });
+    actor::handler<msg_tag<5>>(
+      [](acto::actor_ref, const msg_tag<5>& m) { counter += m.value; });
+    actor::handler<msg_tag<6>>(
+      [](acto::actor_ref, msg_tag<6>&& m) { counter += m.value; });
+  }
+
+private:
+  void do_member(acto::actor_ref, const msg_tag<0>& m) {
+    counter += m.value;
+  }
+};
+
+template <typename M>
+static void deliver(const char* name,
+                    const acto::actor_ref& receiver,
+                    const size_t iterations) {
+  constexpr size_t BATCH = 1024;
+
+  measure(name, iterations, [&] {
+    for (size_t i = 0; i < iterations; i += BATCH) {
+      for (size_t j = 0; j < BATCH; ++j) {
+        receiver.send(M{1});
+      }
+      acto::this_thread::process_messages();
+    }
+  });
+}
+
+int main(int argc, char* argv[]) {
+  const size_t iterations =
+    (argc > 1) ? size_t(std::atoll(argv[1])) : size_t(50000000);
+  const auto messages = make_messages(std::make_index_sequence<TYPES>());
+
+  std::unordered_map<std::type_index, std::unique_ptr<handler_t>> map;
+  std::vector<std::unique_ptr<handler_t>> table;
+
+  for (const auto& msg : messages) {
+    auto func = [](int value) { counter += value; };
+
+    map[msg.index] = std::make_unique<fun_handler_t>(func);
+    if (table.size() <= msg.id) {
+      table.resize(msg.id + 1);
+    }
+    table[msg.id] = std::make_unique<fun_handler_t>(func);
+  }
+
+  const double map_time = measure("map", iterations, [&] {
+    for (size_t i = 0; i < iterations; ++i) {
+      const auto& msg = messages[i % TYPES];
+      const auto hi = map.find(msg.index);
+
+      if (hi != map.end()) {
+        hi->second->invoke(msg);
+      }
+    }
+  });
+
+  const double table_time = measure("table", iterations, [&] {
+    for (size_t i = 0; i < iterations; ++i) {
+      const auto& msg = messages[i % TYPES];
+
+      if (msg.id < table.size()) {
+        if (const auto& h = table[msg.id]) {
+          h->invoke(msg);
+        }
+      }
+    }
+  });
+
+  std::printf("%-24s %8.2fx\n\n", "speedup", map_time / table_time);
+
+  // Deliver messages through a mailbox.
+  const size_t deliveries = iterations / 10;
+  auto receiver = acto::spawn<Signatures>(acto::actor_thread::bind);
+
+  deliver<msg_tag<0>>("(ref, const M&) member", receiver, deliveries);
+  deliver<msg_tag<1>>("()", receiver, deliveries);
+  deliver<msg_tag<2>>("(const M&)", receiver, deliveries);
+  deliver<msg_tag<3>>("(M&&)", receiver, deliveries);
+  deliver<msg_tag<4>>("(ref)", receiver, deliveries);
+  deliver<msg_tag<5>>("(ref, const M&)", receiver, deliveries);
+  deliver<msg_tag<6>>("(ref, M&&)", receiver, deliveries);
+
+  acto::destroy(receiver);
+  acto::this_thread::process_messages();
+
+  // Prevent the loops from being optimized out.
+  std::printf("\n:end %lld\n", counter % 2);
+
+  return 0;
+}
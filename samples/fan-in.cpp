@@ -0,0 +1,156 @@
+///////////////////////////////////////////////////////////////////////////////
+// Desc:                                                                     //
+//    The sample measures throughput of a single actor fed by many           //
+//    producers.                                                             //
+//                                                                           //
+//    The program runs a series of rounds. Each round starts the given       //
+//    number of producer threads, which send messages to the same actor      //
+//    for a fixed period of time. A producer waits for the actor when it     //
+//    is ahead by more than a window of messages, so the mailbox does not    //
+//    grow without bounds. The number of handled messages per second is      //
+//    printed for every round.                                               //
+//                                                                           //
+//    If the batch size is greater than one, producers send messages with    //
+//    message_batch instead of one by one.                                   //
+//                                                                           //
+//    If the fourth argument is "exclusive", the actor gets a dedicated      //
+//    thread.                                                                //
+//                                                                           //
+//    Usage: fan-in [max producers] [workers] [batch size] [exclusive]       //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#include <acto/acto.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Duration of a round.
+static constexpr auto DURATION = std::chrono::milliseconds(1000);
+// Maximum number of messages a producer can be ahead of the consumer.
+static constexpr unsigned long long WINDOW = 4096;
+
+struct msg_item {
+  unsigned int producer;
+};
+
+// Counter placed on its own cache line.
+struct alignas(64) counter_t {
+  std::atomic<unsigned long long> value{0};
+};
+
+// Desc: Counts messages of each producer.
+class Sink : public acto::actor {
+public:
+  Sink(std::vector<counter_t>& counters)
+    : counters_(counters) {
+    actor::handler<msg_item>([this](const msg_item& m) {
+      auto& counter = counters_[m.producer].value;
+      // The only writer.
+      counter.store(counter.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+    });
+  }
+
+private:
+  std::vector<counter_t>& counters_;
+};
+
+static double run_round(const unsigned int producers,
+                        const unsigned int batch_size,
+                        const acto::actor_thread thread_opt) {
+  std::vector<counter_t> counters(producers);
+  std::vector<std::thread> threads;
+  std::atomic<bool> stop{false};
+
+  const auto sink = acto::spawn<Sink>(thread_opt, counters);
+  const auto start = std::chrono::steady_clock::now();
+
+  for (unsigned int i = 0; i < producers; ++i) {
+    threads.emplace_back([&, i] {
+      const auto& handled = counters[i].value;
+      unsigned long long sent = 0;
+
+      while (!stop.load(std::memory_order_relaxed)) {
+        if (sent - handled.load(std::memory_order_acquire) >= WINDOW) {
+          std::this_thread::yield();
+          continue;
+        }
+        if (batch_size > 1) {
+          acto::message_batch batch;
+
+          for (unsigned int j = 0; j < batch_size; ++j) {
+            batch.add(msg_item{i});
+          }
+          sink.send_batch(std::move(batch));
+          sent += batch_size;
+        } else {
+          sink.send(msg_item{i});
+          ++sent;
+        }
+      }
+    });
+  }
+
+  acto::this_thread::sleep_for(DURATION);
+  stop = true;
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  const std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  unsigned long long total = 0;
+
+  for (const auto& counter : counters) {
+    total += counter.value.load();
+  }
+
+  acto::destroy_and_wait(sink);
+
+  return double(total) / elapsed.count();
+}
+
+int main(int argc, char* argv[]) {
+  const unsigned int cores = std::thread::hardware_concurrency();
+  const unsigned int max_producers =
+    (argc > 1) ? unsigned(std::atoi(argv[1])) : std::max(2u, cores * 2);
+  const unsigned int batch_size =
+    (argc > 3) ? unsigned(std::atoi(argv[3])) : 1u;
+  const acto::actor_thread thread_opt =
+    (argc > 4 && std::string_view(argv[4]) == "exclusive")
+      ? acto::actor_thread::exclusive
+      : acto::actor_thread::shared;
+  acto::runtime_config config;
+
+  if (argc > 2) {
+    config.concurrency = unsigned(std::atoi(argv[2]));
+  }
+  acto::configure(config);
+
+  std::printf("Cores   : %u\n", cores);
+  std::printf("Workers : %u\n",
+              config.concurrency ? config.concurrency : cores);
+  std::printf("Batch   : %u\n", std::max(1u, batch_size));
+  std::printf("Sink    : %s\n\n",
+              thread_opt == acto::actor_thread::exclusive ? "exclusive"
+                                                           : "shared");
+  std::printf("%10s %16s\n", "producers", "messages/s");
+
+  for (unsigned int producers = 1; producers <= max_producers; producers *= 2)
+  {
+    std::printf("%10u %16.0f\n", producers,
+                run_round(producers, batch_size, thread_opt));
+
+    acto::shutdown();
+  }
+
+  return 0;
+}
@@ -26,6 +26,7 @@
 #include <cstdlib>
 #include <iostream>
 #include <string>
+#include <vector>
 
 // Кол-во мячей в игре
 static const int BALLS    = 1  * 1000;
@@ -133,7 +134,7 @@ class Wall : public acto::actor {
   // Консоль
   acto::actor_ref m_console;
   // Множество игроков
-  acto::actor_ref m_players[ PLAYERS ];
+  std::vector<acto::actor_ref> m_players;
   // Счетчик отскоков мячей от стены
   long long       m_counter;
   // Признак окончания игры
@@ -149,8 +150,7 @@ public:
     handler< msg_start  >( &Wall::do_start  );
 
     // Инициализация игроков
-    for (int i = 0; i < PLAYERS; i++)
-      m_players[i] = acto::spawn< Player >();
+    m_players = acto::spawn_n< Player >(PLAYERS);
   }
 
   ~Wall() {
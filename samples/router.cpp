@@ -0,0 +1,101 @@
+///////////////////////////////////////////////////////////////////////////////
+// Desc:                                                                     //
+//    The sample measures the cost of sending messages through a router      //
+//    for each routing strategy. Sending to routees selected in turn by      //
+//    the sender itself is shown for comparison. The sender waits for the    //
+//    routees when it is ahead by more than a window of messages.            //
+//                                                                           //
+//    Usage: router [routees] [messages]                                     //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#include <acto/acto.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// Maximum number of messages the sender can be ahead of the routees.
+static constexpr unsigned long WINDOW = 4096;
+
+struct msg_job {
+  unsigned long key;
+};
+
+// Desc: Counts handled jobs.
+class Worker : public acto::actor {
+public:
+  Worker(std::atomic<unsigned long>& handled) {
+    actor::handler<msg_job>([&handled](const msg_job&) {
+      handled.fetch_add(1, std::memory_order_relaxed);
+    });
+  }
+};
+
+template <typename F>
+static void measure(const char* name,
+                    std::atomic<unsigned long>& handled,
+                    const unsigned long count,
+                    F&& f) {
+  const unsigned long base = handled.load();
+  const unsigned long expected = base + count;
+  const auto start = std::chrono::steady_clock::now();
+
+  for (unsigned long i = 0; i < count; ++i) {
+    while (i - (handled.load() - base) >= WINDOW) {
+      std::this_thread::yield();
+    }
+    f(msg_job{i});
+  }
+  while (handled.load() < expected) {
+    std::this_thread::yield();
+  }
+
+  const std::chrono::duration<double, std::nano> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  std::printf("%-18s %8.2f ns/msg\n", name, elapsed.count() / double(count));
+}
+
+int main(int argc, char* argv[]) {
+  const unsigned int routees = (argc > 1) ? unsigned(std::atoi(argv[1])) : 16u;
+  const unsigned long count =
+    (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 2000000ul;
+  std::atomic<unsigned long> handled{0};
+  const auto workers = acto::spawn_n<Worker>(routees, handled);
+
+  std::printf("Routees  : %u\n", routees);
+  std::printf("Messages : %lu\n\n", count);
+
+  measure("direct", handled, count, [&, next = size_t(0)](msg_job m) mutable {
+    workers[next++ % workers.size()].send(m);
+  });
+
+  const struct {
+    const char* name;
+    acto::routing_strategy strategy;
+  } strategies[] = {
+    {"round robin", acto::routing_strategy::round_robin},
+    {"random", acto::routing_strategy::random},
+    {"smallest mailbox", acto::routing_strategy::smallest_mailbox},
+    {"consistent hash", acto::routing_strategy::consistent_hash},
+  };
+
+  for (const auto& s : strategies) {
+    const auto router = acto::make_router(
+      s.strategy, workers,
+      acto::routing_keys().key<msg_job>([](const msg_job& m) { return m.key; }));
+
+    measure(s.name, handled, count, [&](msg_job m) { router.send(m); });
+  }
+
+  for (const auto& w : workers) {
+    acto::destroy(w);
+  }
+  acto::shutdown();
+
+  return 0;
+}
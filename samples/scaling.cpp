@@ -0,0 +1,112 @@
+///////////////////////////////////////////////////////////////////////////////
+// Desc:                                                                     //
+//    The sample measures how message throughput of the shared pool scales   //
+//    with the number of concurrently active actors.                         //
+//                                                                           //
+//    The program runs a series of rounds. Each round spawns the given       //
+//    number of independent pairs of players, which bounce a ball to each    //
+//    other for a fixed period of time. The total number of handled balls    //
+//    per second is printed for every round. To see how the scheduler        //
+//    scales with the core count run the sample with different number of     //
+//    workers or under taskset(1) with different CPU masks.                  //
+//                                                                           //
+//    Usage: scaling [max pairs] [workers]                                   //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#include <acto/acto.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// Duration of a round.
+static constexpr auto DURATION = std::chrono::milliseconds(1000);
+
+// Bounce the ball.
+struct msg_ball { };
+
+// Counter placed on its own cache line.
+struct alignas(64) counter_t {
+  unsigned long long value{0};
+};
+
+// Desc: Sends the ball back to the sender.
+class Player : public acto::actor {
+public:
+  Player(counter_t& counter)
+    : counter_(counter) {
+    handler<msg_ball>(&Player::do_ball);
+  }
+
+private:
+  void do_ball(acto::actor_ref sender, const msg_ball&) {
+    ++counter_.value;
+    sender.send(msg_ball());
+  }
+
+private:
+  counter_t& counter_;
+};
+
+static double run_round(const unsigned int pairs) {
+  std::vector<counter_t> counters(pairs * 2);
+  std::vector<acto::actor_ref> players;
+
+  for (unsigned int i = 0; i < pairs * 2; ++i) {
+    players.push_back(acto::spawn<Player>(counters[i]));
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  // Put a ball into each pair.
+  for (unsigned int i = 0; i < pairs; ++i) {
+    players[i * 2].send_on_behalf(players[i * 2 + 1], msg_ball());
+  }
+
+  acto::this_thread::sleep_for(DURATION);
+  // Stop the game.
+  for (const auto& player : players) {
+    acto::destroy(player);
+  }
+  for (const auto& player : players) {
+    acto::join(player);
+  }
+
+  const std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  unsigned long long total = 0;
+
+  for (const auto& counter : counters) {
+    total += counter.value;
+  }
+
+  return double(total) / elapsed.count();
+}
+
+int main(int argc, char* argv[]) {
+  const unsigned int cores = std::thread::hardware_concurrency();
+  const unsigned int max_pairs =
+    (argc > 1) ? unsigned(std::atoi(argv[1])) : std::max(2u, cores * 2);
+  acto::runtime_config config;
+
+  if (argc > 2) {
+    config.concurrency = unsigned(std::atoi(argv[2]));
+  }
+  acto::configure(config);
+
+  std::printf("Cores   : %u\n", cores);
+  std::printf("Workers : %u\n\n",
+              config.concurrency ? config.concurrency : cores);
+  std::printf("%8s %16s\n", "pairs", "messages/s");
+
+  for (unsigned int pairs = 1; pairs <= max_pairs; pairs *= 2) {
+    std::printf("%8u %16.0f\n", pairs, run_round(pairs));
+
+    acto::shutdown();
+  }
+
+  return 0;
+}
@@ -0,0 +1,76 @@
+///////////////////////////////////////////////////////////////////////////////
+// Desc:                                                                     //
+//    The sample measures the cost of creating a large population of         //
+//    actors:                                                                //
+//      - spawn   : actors are spawned one by one;                           //
+//      - spawn_n : actors are spawned at once.                              //
+//    The time of destruction of the actors is printed separately.           //
+//                                                                           //
+//    Usage: spawn [actors]                                                  //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#include <acto/acto.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+struct msg_get {
+  int key;
+};
+
+// Desc: Entry of a cache.
+class Entry : public acto::actor {
+public:
+  Entry() {
+    actor::handler<msg_get>(
+      [this](acto::actor_ref sender, const msg_get&) { sender.send(value_); });
+  }
+
+private:
+  int value_{0};
+};
+
+template <typename F>
+static void measure(const char* name, const size_t count, F&& f) {
+  const auto start = std::chrono::steady_clock::now();
+
+  f();
+
+  const std::chrono::duration<double, std::nano> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  std::printf("%-16s %8.2f ns/actor\n", name, elapsed.count() / double(count));
+}
+
+static void destroy_all(std::vector<acto::actor_ref>& actors) {
+  for (const auto& a : actors) {
+    acto::destroy(a);
+  }
+  actors.clear();
+}
+
+int main(int argc, char* argv[]) {
+  const size_t count =
+    (argc > 1) ? size_t(std::atoll(argv[1])) : size_t(1000000);
+  std::vector<acto::actor_ref> actors;
+
+  std::printf("Actors : %zu\n\n", count);
+
+  measure("spawn", count, [&] {
+    actors.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      actors.push_back(acto::spawn<Entry>());
+    }
+  });
+  measure("  destroy", count, [&] { destroy_all(actors); });
+
+  measure("spawn_n", count, [&] { actors = acto::spawn_n<Entry>(count); });
+  measure("  destroy", count, [&] { destroy_all(actors); });
+
+  acto::shutdown();
+
+  return 0;
+}
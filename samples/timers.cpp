@@ -0,0 +1,97 @@
+///////////////////////////////////////////////////////////////////////////////
+// Desc:                                                                     //
+//    The sample measures the cost of timers.                                //
+//                                                                           //
+//    First the given number of timers is set to fire in a minute and then   //
+//    all of them are cancelled, the time per operation is printed for       //
+//    both. Then the same number of timers is set to fire within a second    //
+//    and the program waits for all messages to be delivered.                //
+//                                                                           //
+//    Usage: timers [timers]                                                 //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#include <acto/acto.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+struct msg_timeout {
+  unsigned int id;
+};
+
+// Desc: Counts delivered messages.
+class Counter : public acto::actor {
+public:
+  Counter(std::atomic<unsigned long>& delivered) {
+    actor::handler<msg_timeout>([&delivered](const msg_timeout&) {
+      delivered.fetch_add(1, std::memory_order_relaxed);
+    });
+  }
+};
+
+template <typename F>
+static void measure(const char* name, const unsigned int count, F&& f) {
+  const auto start = std::chrono::steady_clock::now();
+
+  f();
+
+  const std::chrono::duration<double, std::nano> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  std::printf("%-10s %8.2f ns/timer\n", name, elapsed.count() / double(count));
+}
+
+int main(int argc, char* argv[]) {
+  const unsigned int count =
+    (argc > 1) ? unsigned(std::atoi(argv[1])) : 1000000u;
+  std::atomic<unsigned long> delivered{0};
+  std::vector<acto::timer> timers;
+  const auto counter = acto::spawn<Counter>(delivered);
+
+  timers.reserve(count);
+
+  std::printf("Timers : %u\n\n", count);
+
+  measure("insert", count, [&] {
+    for (unsigned int i = 0; i < count; ++i) {
+      timers.push_back(acto::send_after(
+        counter, std::chrono::seconds(60) + std::chrono::microseconds(i),
+        msg_timeout{i}));
+    }
+  });
+
+  measure("cancel", count, [&] {
+    for (auto& timer : timers) {
+      timer.cancel();
+    }
+  });
+
+  timers.clear();
+
+  const auto start = std::chrono::steady_clock::now();
+
+  for (unsigned int i = 0; i < count; ++i) {
+    // Spread deadlines over a second.
+    acto::send_after(counter, std::chrono::microseconds(i % 1000000),
+                     msg_timeout{i});
+  }
+  while (delivered.load() < count) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  const std::chrono::duration<double, std::milli> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  std::printf("%-10s %8lu in %.0f ms\n", "delivered", delivered.load(),
+              elapsed.count());
+
+  acto::destroy_and_wait(counter);
+  acto::shutdown();
+
+  return 0;
+}
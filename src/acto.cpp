@@ -1,20 +1,28 @@
 #include "acto/acto.h"
 #include "runtime.h"
 
+#include <algorithm>
+
 namespace acto {
+namespace {
+
+/// Message resuming a suspended coroutine handler.
+struct resume_t { };
+
+} // namespace
 
 actor_ref::actor_ref(core::object_t* const an_object,
                      const bool acquire) noexcept
   : object_(an_object) {
   if (object_ && acquire) {
-    core::runtime_t::instance()->acquire(object_);
+    object_->runtime->acquire(object_);
   }
 }
 
 actor_ref::actor_ref(const actor_ref& rhs) noexcept
   : object_(rhs.object_) {
   if (object_) {
-    core::runtime_t::instance()->acquire(object_);
+    object_->runtime->acquire(object_);
   }
 }
 
@@ -25,7 +33,7 @@ actor_ref::actor_ref(actor_ref&& rhs) noexcept
 
 actor_ref::~actor_ref() {
   if (object_) {
-    core::runtime_t::instance()->release(object_);
+    core::runtime_t::release_deferred(object_);
   }
 }
 
@@ -35,27 +43,46 @@ bool actor_ref::assigned() const noexcept {
 
 void actor_ref::join() const {
   if (object_) {
-    core::runtime_t::instance()->join(object_);
+    object_->runtime->join(object_);
   }
 }
 
 bool actor_ref::send_message(std::unique_ptr<core::msg_t> msg) const {
-  return core::runtime_t::instance()->send(object_, std::move(msg));
+  return object_->runtime->send(object_, std::move(msg));
+}
+
+bool actor_ref::try_send_message(std::unique_ptr<core::msg_t> msg) const {
+  return object_->runtime->try_send(object_, std::move(msg));
+}
+
+bool actor_ref::send_batch(message_batch&& batch) const {
+  if (batch.empty()) {
+    return true;
+  }
+  if (!object_) {
+    batch.clear();
+    return false;
+  }
+
+  core::msg_t* const first = std::exchange(batch.head_, nullptr);
+  core::msg_t* const last = std::exchange(batch.tail_, nullptr);
+
+  return object_->runtime->send_batch(object_, first, last,
+                                      std::exchange(batch.size_, 0));
 }
 
 bool actor_ref::send_message_on_behalf(core::object_t* sender,
                                        std::unique_ptr<core::msg_t> msg) const {
-  return core::runtime_t::instance()->send_on_behalf(object_, sender,
-                                                     std::move(msg));
+  return object_->runtime->send_on_behalf(object_, sender, std::move(msg));
 }
 
 actor_ref& actor_ref::operator=(const actor_ref& rhs) {
   if (this != &rhs) {
     if (rhs.object_) {
-      core::runtime_t::instance()->acquire(rhs.object_);
+      rhs.object_->runtime->acquire(rhs.object_);
     }
     if (object_) {
-      core::runtime_t::instance()->release(object_);
+      object_->runtime->release(object_);
     }
     object_ = rhs.object_;
   }
@@ -65,7 +92,7 @@ actor_ref& actor_ref::operator=(const actor_ref& rhs) {
 actor_ref& actor_ref::operator=(actor_ref&& rhs) {
   if (this != &rhs) {
     if (object_ && object_ != rhs.object_) {
-      core::runtime_t::instance()->release(object_);
+      object_->runtime->release(object_);
     }
     object_ = rhs.object_;
     rhs.object_ = nullptr;
@@ -73,29 +100,114 @@ actor_ref& actor_ref::operator=(actor_ref&& rhs) {
   return *this;
 }
 
+message_batch::message_batch(message_batch&& rhs) noexcept
+  : head_(std::exchange(rhs.head_, nullptr))
+  , tail_(std::exchange(rhs.tail_, nullptr))
+  , size_(std::exchange(rhs.size_, 0)) {
+}
+
+message_batch::~message_batch() {
+  clear();
+}
+
+void message_batch::clear() noexcept {
+  while (core::msg_t* const msg = head_) {
+    head_ = msg->next;
+    delete msg;
+  }
+  tail_ = nullptr;
+  size_ = 0;
+}
+
+void message_batch::push(std::unique_ptr<core::msg_t> msg) noexcept {
+  core::msg_t* const p = msg.release();
+  // The chain is linked in the order of a stack, so the latest message
+  // is at the head.
+  p->next = head_;
+  head_ = p;
+  if (!tail_) {
+    tail_ = p;
+  }
+  ++size_;
+}
+
+void routing_keys::set_key(const uint32_t type,
+                           std::shared_ptr<const core::key_function_t> f) {
+  if (type >= keys_.size()) {
+    keys_.resize(type + 1);
+  }
+  keys_[type] = std::move(f);
+}
+
+actor::~actor() noexcept {
+  // Frames are allocated with a header, see runtime_t::allocate_frame().
+  ::operator delete(frame_cache_);
+}
+
 void actor::die() noexcept {
   terminating_ = true;
 }
 
 void actor::consume_package(std::unique_ptr<core::msg_t> p) {
-  const auto hi = handlers_.find(p->type);
-  if (hi != handlers_.end()) {
-    hi->second->invoke(std::move(p));
+  // Ids below the base wrap around to large indices.
+  const uint32_t index = p->type - handlers_base_;
+
+  if (index < handlers_.size()) {
+    if (const auto& h = handlers_[index]) {
+      h->invoke(p.get());
+      // The handler has been suspended, so keep the message
+      // until it completes.
+      if (awaiting_) [[unlikely]] {
+        awaiting_msg_ = std::move(p);
+      }
+      return;
+    }
+  }
+  if (p->type == core::type_id<resume_t>()) {
+    resume();
   }
 }
 
-void actor::set_handler(const std::type_index& type,
-                        std::unique_ptr<handler_t> h) {
-  if (h) {
-    handlers_[type] = std::move(h);
-  } else {
-    handlers_.erase(type);
+void actor::resume() {
+  if (const std::coroutine_handle<> h = std::exchange(awaiting_, nullptr)) {
+    h.resume();
+    // The handler has completed unless it has been suspended again.
+    if (!awaiting_) {
+      awaiting_msg_.reset();
+    }
   }
 }
 
+void actor::set_handler(const uint32_t type, std::unique_ptr<handler_t> h) {
+  if (!h) {
+    const uint32_t index = type - handlers_base_;
+
+    if (index < handlers_.size()) {
+      handlers_[index].reset();
+    }
+    return;
+  }
+  // Extend the table to cover the type.
+  if (handlers_.empty()) {
+    handlers_base_ = type;
+    handlers_.resize(1);
+  } else if (type < handlers_base_) {
+    handlers table(handlers_.size() + (handlers_base_ - type));
+
+    std::move(handlers_.begin(), handlers_.end(),
+              table.begin() + (handlers_base_ - type));
+    handlers_.swap(table);
+    handlers_base_ = type;
+  } else if (type - handlers_base_ >= handlers_.size()) {
+    handlers_.resize(type - handlers_base_ + 1);
+  }
+
+  handlers_[type - handlers_base_] = std::move(h);
+}
+
 void destroy(const actor_ref& object) {
   if (bool(object)) {
-    core::runtime_t::instance()->deconstruct_object(object.object_);
+    object.object_->runtime->deconstruct_object(object.object_);
   }
 }
 
@@ -108,54 +220,382 @@ void join(const actor_ref& obj) {
   obj.join();
 }
 
+actor_ref make_router(const routing_strategy strategy,
+                      std::vector<actor_ref> routees,
+                      routing_keys keys) {
+  return core::runtime_t::current()->make_router(strategy, std::move(routees),
+                                                 std::move(keys));
+}
+
 bool this_thread::process_messages() {
-  return core::runtime_t::instance()->process_binded_actors();
+  return core::runtime_t::process_binded_actors(nullptr);
+}
+
+bool this_thread::process_messages(const process_budget& budget) {
+  return core::runtime_t::process_binded_actors(&budget);
 }
 
 void shutdown() {
   core::runtime_t::instance()->shutdown();
 }
 
+bool configure(const runtime_config& config) {
+  return core::runtime_t::configure(config);
+}
+
+runtime::runtime(const runtime_config& config)
+  : impl_(new core::runtime_t(config)) {
+}
+
+runtime::~runtime() {
+  impl_->shutdown();
+  impl_->stop();
+  // The instance will be deleted when all its objects are gone.
+  impl_->unref();
+}
+
+void runtime::shutdown() {
+  impl_->shutdown();
+}
+
 namespace core {
 
-object_t::object_t(const actor_thread thread_opt, std::unique_ptr<actor> body)
-  : impl(body.release())
+uint32_t next_type_id() noexcept {
+  static std::atomic<uint32_t> counter{0};
+
+  return counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+object_t::object_t(runtime_t* const owner,
+                   const actor_thread thread_opt,
+                   const actor_priority prio,
+                   std::unique_ptr<actor> body)
+  : runtime(owner)
+  , impl(body.release())
   , references(1)
+  , priority(prio)
+  , capacity(impl->capacity_)
+  , overflow(impl->overflow_)
   , binded(thread_opt == actor_thread::bind)
-  , exclusive(thread_opt == actor_thread::exclusive)
-  , deleting(false)
-  , scheduled(false) {
+  , exclusive(thread_opt == actor_thread::exclusive) {
+}
+
+object_t::object_t(runtime_t* const owner,
+                   actor* const body,
+                   arena_t* const block)
+  : runtime(owner)
+  , impl(body)
+  , references(1)
+  , priority(actor_priority::normal)
+  , capacity(impl->capacity_)
+  , overflow(impl->overflow_)
+  , binded(false)
+  , exclusive(false)
+  , arena(block) {
+}
+
+object_t::object_t(runtime_t* const owner, router_t* const table)
+  : runtime(owner)
+  , impl(nullptr)
+  , references(1)
+  , priority(actor_priority::normal)
+  , capacity(0)
+  , overflow(overflow_policy::reject)
+  , binded(false)
+  , exclusive(false)
+  , router(table) {
 }
 
-void object_t::enqueue(std::unique_ptr<msg_t> msg) noexcept {
-  input_stack.push(msg.release());
+object_t::object_t(runtime_t* const owner, reply_t* const slot)
+  : runtime(owner)
+  , impl(nullptr)
+  , references(1)
+  , priority(actor_priority::normal)
+  , capacity(0)
+  , overflow(overflow_policy::reject)
+  , binded(false)
+  , exclusive(false)
+  , reply(slot) {
+}
+
+void object_t::enqueue(msg_t* const first, msg_t* const last) noexcept {
+  input_stack.push(first, last);
 }
 
 bool object_t::has_messages() const noexcept {
   return !local_stack.empty() || !input_stack.empty();
 }
 
-std::unique_ptr<msg_t> object_t::select_message() noexcept {
+bool object_t::runnable() const noexcept {
+  if (const uint32_t value = suspension.load()) [[unlikely]] {
+    return value == RESUMABLE;
+  }
+  return has_messages();
+}
+
+std::unique_ptr<msg_t> object_t::select_message(const bool refill) noexcept {
+  // Messages wait until the suspended handler completes.
+  if (const uint32_t value = suspension.load()) [[unlikely]] {
+    if (value != RESUMABLE) {
+      return nullptr;
+    }
+    suspension.store(0);
+    state.fetch_and(~SUSPENDED);
+    return std::make_unique<msg_t>(type_id<resume_t>());
+  }
+  if (capacity == 0) {
+    std::unique_ptr<msg_t> msg{pop_message(refill)};
+    // The size of the mailbox is observed by a router.
+    if (msg && msg->counted) [[unlikely]] {
+      queued.fetch_sub(1);
+    }
+    return msg;
+  }
+  // Discard the oldest messages above the capacity.
+  if (overflow == overflow_policy::drop_oldest) {
+    while (take_excess(1)) {
+      if (!std::unique_ptr<msg_t>{pop_message(refill)}) {
+        queued.fetch_add(1);
+        break;
+      }
+    }
+  }
+
+  std::unique_ptr<msg_t> msg{pop_message(refill)};
+
+  if (msg) {
+    queued.fetch_sub(1);
+    // Wakeup a sender waiting for room in the mailbox.
+    if (blocked_senders.load()) {
+      space_event.signaled();
+    }
+  }
+  return msg;
+}
+
+uint32_t object_t::unschedule() noexcept {
+  const uint32_t prev = state.fetch_and(~SCHEDULED) & ~SCHEDULED;
+  // A sender might have seen the object scheduled after the mailbox
+  // was checked last time.
+  if (runnable() && !(state.fetch_or(SCHEDULED) & SCHEDULED)) {
+    return prev | SCHEDULED;
+  }
+  return prev;
+}
+
+void object_t::evict_oldest() noexcept {
+  msg_t* dropped = nullptr;
+
+  {
+    std::lock_guard g(evict_lock);
+    // The newest message is never evicted, as producers are pushing
+    // messages on top of it.
+    msg_t* const top = input_stack.top();
+
+    if (!top) {
+      return;
+    }
+
+    unsigned long count = 0;
+
+    for (msg_t* p = top->next; p; p = p->next) {
+      ++count;
+    }
+    // Keep the newest messages and cut the oldest ones off the stack.
+    if (const unsigned long n = take_excess(count)) {
+      msg_t* last = top;
+
+      for (unsigned long i = n; i < count; ++i) {
+        last = last->next;
+      }
+      dropped = std::exchange(last->next, nullptr);
+    }
+  }
+
+  while (dropped) {
+    std::unique_ptr<msg_t> msg{std::exchange(dropped, dropped->next)};
+  }
+}
+
+msg_t* object_t::pop_message(const bool refill) noexcept {
   if (msg_t* p = local_stack.pop()) {
-    return std::unique_ptr<msg_t>(p);
-  } else {
-    local_stack.push(input_stack.extract());
-    return std::unique_ptr<msg_t>(local_stack.pop());
+    return p;
+  } else if (refill) {
+    if (overflow == overflow_policy::drop_oldest) {
+      std::lock_guard g(evict_lock);
+      local_stack.push(input_stack.extract());
+    } else {
+      local_stack.push(input_stack.extract());
+    }
+    return local_stack.pop();
   }
+  return nullptr;
+}
+
+unsigned long object_t::take_excess(const unsigned long limit) noexcept {
+  unsigned long value = queued.load();
+  unsigned long n;
+
+  do {
+    if (value <= capacity) {
+      return 0;
+    }
+    n = std::min(value - capacity, limit);
+  } while (!queued.compare_exchange_weak(value, value - n));
+
+  return n;
+}
+
+namespace {
+
+constexpr size_t align_up(const size_t size, const size_t alignment) {
+  return (size + alignment - 1) & ~(alignment - 1);
+}
+
+} // namespace
+
+arena_t::arena_t(const size_t n,
+                 const size_t body_size,
+                 const size_t body_alignment) noexcept
+  : count(n)
+  , alignment(std::max<size_t>(64, body_alignment))
+  , start(align_up(sizeof(arena_t), alignment))
+  , offset(align_up(sizeof(object_t), body_alignment))
+  , stride(align_up(offset + body_size, alignment))
+  , references(n) {
+}
+
+arena_t* make_arena(const size_t count,
+                    const size_t body_size,
+                    const size_t body_alignment) {
+  const arena_t layout(count, body_size, body_alignment);
+  void* const ptr =
+    ::operator new(layout.start + count * layout.stride,
+                   std::align_val_t(layout.alignment));
+
+  return new (ptr) arena_t(count, body_size, body_alignment);
+}
+
+void delete_arena(arena_t* const arena) noexcept {
+  const size_t size = arena->start + arena->count * arena->stride;
+  const std::align_val_t alignment{arena->alignment};
+
+  arena->~arena_t();
+  ::operator delete(static_cast<void*>(arena), size, alignment);
 }
 
 msg_t::~msg_t() {
   // Release references.
   if (sender) {
-    runtime_t::instance()->release(sender);
+    runtime_t::release_deferred(sender);
+  }
+}
+
+msg_shared_t::~msg_shared_t() {
+  if (payload->references.fetch_sub(1) == 1) {
+    delete payload;
+  }
+}
+
+reply_t::reply_t(runtime_t* const owner, const uint32_t reply_type)
+  : object(owner, this)
+  , type(reply_type) {
+}
+
+reply_t::~reply_t() {
+  delete msg;
+}
+
+void reply_t::release() noexcept {
+  if (owners.fetch_sub(1) == 1) {
+    delete this;
   }
 }
 
+reply_t* ask(const actor_ref& target,
+             std::unique_ptr<msg_t> msg,
+             const uint32_t reply_type) {
+  return runtime_t::ask(target, std::move(msg), reply_type);
+}
+
+void* allocate_frame(const size_t size) {
+  return runtime_t::allocate_frame(size);
+}
+
+void deallocate_frame(void* const ptr) noexcept {
+  runtime_t::deallocate_frame(ptr);
+}
+
+bool await_reply(reply_t* const slot, const std::coroutine_handle<> h) {
+  return runtime_t::await_reply(slot, h);
+}
+
+bool await_delay(const std::chrono::steady_clock::time_point deadline,
+                 const std::coroutine_handle<> h) {
+  return runtime_t::await_delay(deadline, h);
+}
+
+size_t multicast(std::span<const actor_ref> targets,
+                 shared_payload_t* const payload,
+                 const uint32_t type) {
+  return runtime_t::multicast(targets, payload, type);
+}
+
+timer_entry_t* send_after(const actor_ref& target,
+                          const std::chrono::nanoseconds delay,
+                          std::unique_ptr<msg_t> msg) {
+  return runtime_t::send_after(target, delay, std::move(msg));
+}
+
+timer_entry_t* send_every(const actor_ref& target,
+                          const std::chrono::nanoseconds period,
+                          shared_payload_t* const payload,
+                          const uint32_t type) {
+  return runtime_t::send_every(target, period, payload, type);
+}
+
+bool cancel_timer(timer_entry_t* const entry) {
+  return timer_wheel_t::cancel(entry);
+}
+
+void release_timer(timer_entry_t* const entry) noexcept {
+  timer_wheel_t::release(entry);
+}
+
 object_t* make_instance(actor_ref context,
                         const actor_thread opt,
+                        const actor_priority priority,
                         std::unique_ptr<actor> body) {
-  return runtime_t::instance()->make_instance(std::move(context), opt,
-                                              std::move(body));
+  return runtime_t::current()->make_instance(std::move(context), opt,
+                                             priority, std::move(body));
+}
+
+object_t* make_instance(runtime& rt,
+                        actor_ref context,
+                        const actor_thread opt,
+                        const actor_priority priority,
+                        std::unique_ptr<actor> body) {
+  return rt.impl_->make_instance(std::move(context), opt, priority,
+                                 std::move(body));
+}
+
+void make_instances(runtime* const rt,
+                    arena_t* const arena,
+                    const body_cast_t cast,
+                    std::vector<actor_ref>& result) {
+  runtime_t* const owner = rt ? rt->impl_ : runtime_t::current();
+
+  owner->make_instances(arena, cast, result);
+}
+
+blocking_guard::blocking_guard()
+  : runtime_(runtime_t::enter_blocking()) {
+}
+
+blocking_guard::~blocking_guard() {
+  if (runtime_) {
+    runtime_->leave_blocking();
+  }
 }
 
 } // namespace core
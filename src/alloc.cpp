@@ -0,0 +1,340 @@
+#include "acto/acto.h"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <thread>
+
+#if defined(_MSC_VER)
+# include <malloc.h>
+#endif
+
+namespace acto {
+namespace core {
+namespace {
+
+/// Size and alignment of a chunk of blocks.
+constexpr size_t CHUNK_SIZE = 64 << 10;
+/// Granularity of size classes.
+constexpr size_t GRANULE = 16;
+/// Maximum size of a block served by the pool.
+constexpr size_t MAX_BLOCK_SIZE = 512;
+/// Number of size classes.
+constexpr size_t CLASSES = MAX_BLOCK_SIZE / GRANULE;
+/// Number of blocks freed by a thread which are returned to the heap
+/// owning them at once. Fewer blocks are held back by the thread until
+/// it frees blocks of another heap or exits.
+constexpr unsigned int REMOTE_BATCH = 32;
+
+struct heap_t;
+
+struct block_t {
+  block_t* next;
+};
+
+/**
+ * Header of a chunk.
+ *
+ * All blocks of a chunk have the same size and belong to the same heap,
+ * so the owner of a block is found by masking its address.
+ */
+struct alignas(64) chunk_t {
+  heap_t* owner;
+};
+
+/**
+ * Per-thread cache of blocks.
+ *
+ * Blocks are allocated and freed by the owner thread without any
+ * synchronization. Other threads return blocks through lock-free
+ * remote lists, which the owner takes over as a whole when its local
+ * list runs out. A thread collects blocks of the same heap and returns
+ * them as a single chain.
+ */
+struct heap_t {
+  struct bin_t {
+    /// Blocks freed by the owner.
+    block_t* local{nullptr};
+    /// Blocks freed by other threads.
+    std::atomic<block_t*> remote{nullptr};
+    /// Unused space of the last chunk.
+    char* bump{nullptr};
+    char* end{nullptr};
+    /// Blocks of another heap freed by the owner of this one,
+    /// waiting to be returned to the bin of that heap.
+    struct {
+      bin_t* target{nullptr};
+      block_t* first{nullptr};
+      block_t* last{nullptr};
+      unsigned int count{0};
+    } outgoing;
+  };
+
+  bin_t bins[CLASSES];
+  /// Link in the list of abandoned heaps.
+  heap_t* next{nullptr};
+};
+
+/// Heaps of finished threads waiting to be adopted by new ones.
+struct {
+  intrusive::spin_lock mutex;
+  heap_t* head{nullptr};
+} abandoned;
+
+heap_t* acquire_heap() {
+  {
+    std::lock_guard g(abandoned.mutex);
+
+    if (heap_t* const heap = abandoned.head) {
+      abandoned.head = heap->next;
+      heap->next = nullptr;
+      return heap;
+    }
+  }
+  return new heap_t;
+}
+
+/// Places the chain of blocks into the remote list of the bin.
+void push_remote(heap_t::bin_t& bin,
+                 block_t* const first,
+                 block_t* const last) {
+  last->next = bin.remote.load(std::memory_order_relaxed);
+
+  while (!bin.remote.compare_exchange_weak(last->next, first,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed))
+  { }
+}
+
+/// Returns the collected blocks to their heap.
+void flush_outgoing(heap_t::bin_t& bin) {
+  if (bin.outgoing.first) {
+    push_remote(*bin.outgoing.target, bin.outgoing.first, bin.outgoing.last);
+    bin.outgoing = {};
+  }
+}
+
+void abandon_heap(heap_t* const heap) {
+  // Do not hold blocks of other heaps while nobody frees anything here.
+  for (heap_t::bin_t& bin : heap->bins) {
+    flush_outgoing(bin);
+  }
+
+  std::lock_guard g(abandoned.mutex);
+
+  heap->next = abandoned.head;
+  abandoned.head = heap;
+}
+
+/// Heap of the current thread.
+/// The pointer is trivially destructible, so it is still accessible while
+/// other thread local objects are being destroyed.
+thread_local heap_t* current_heap = nullptr;
+/// The heap holder of the thread has been destroyed.
+thread_local bool thread_exiting = false;
+
+/// Returns the heap to the abandoned list when the thread exits.
+struct heap_holder_t {
+  heap_t* heap{nullptr};
+
+  ~heap_holder_t() {
+    if (heap) {
+      abandon_heap(heap);
+    }
+    // Messages allocated during destruction of other thread local
+    // objects are taken from borrowed heaps.
+    current_heap = nullptr;
+    thread_exiting = true;
+  }
+};
+
+thread_local heap_holder_t heap_holder;
+
+heap_t* thread_heap() {
+  assert(!thread_exiting);
+
+  if (current_heap == nullptr) {
+    current_heap = acquire_heap();
+    // Abandon the heap at thread exit.
+    heap_holder.heap = current_heap;
+  }
+  return current_heap;
+}
+
+/// Allocates memory for a new chunk.
+/// Chunks are never released, as blocks are reused by other threads.
+void* allocate_chunk() {
+#if defined(_MSC_VER)
+  void* const ptr = _aligned_malloc(CHUNK_SIZE, CHUNK_SIZE);
+#else
+  void* const ptr = std::aligned_alloc(CHUNK_SIZE, CHUNK_SIZE);
+#endif
+
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void* allocate_block(heap_t* const heap, const size_t cls) {
+  heap_t::bin_t& bin = heap->bins[cls];
+  const size_t size = (cls + 1) * GRANULE;
+
+  if (block_t* const block = bin.local) {
+    bin.local = block->next;
+    return block;
+  }
+  // Take over all blocks returned by other threads at once.
+  if (bin.remote.load(std::memory_order_relaxed)) {
+    if (block_t* const block =
+          bin.remote.exchange(nullptr, std::memory_order_acquire))
+    {
+      bin.local = block->next;
+      return block;
+    }
+  }
+  if (bin.bump + size > bin.end) {
+    chunk_t* const chunk = new (allocate_chunk()) chunk_t{heap};
+
+    bin.bump = reinterpret_cast<char*>(chunk + 1);
+    bin.end = reinterpret_cast<char*>(chunk) + CHUNK_SIZE;
+  }
+
+  void* const result = bin.bump;
+  bin.bump += size;
+  return result;
+}
+
+void* pool_allocate(const size_t size) {
+  if (size > MAX_BLOCK_SIZE) {
+    return ::operator new(size);
+  }
+
+  const size_t cls = (size + GRANULE - 1) / GRANULE - 1;
+
+  if (thread_exiting) [[unlikely]] {
+    // The thread cannot keep a heap anymore, so one is borrowed for
+    // a single block. The block will be freed as a remote one.
+    heap_t* const heap = acquire_heap();
+    void* const result = allocate_block(heap, cls);
+
+    abandon_heap(heap);
+    return result;
+  }
+  return allocate_block(thread_heap(), cls);
+}
+
+void pool_deallocate(void* const ptr, const size_t size) {
+  if (size > MAX_BLOCK_SIZE) {
+    ::operator delete(ptr, size);
+    return;
+  }
+
+  const size_t cls = (size + GRANULE - 1) / GRANULE - 1;
+  const chunk_t* const chunk = reinterpret_cast<const chunk_t*>(
+    reinterpret_cast<uintptr_t>(ptr) & ~uintptr_t(CHUNK_SIZE - 1));
+  heap_t::bin_t& bin = chunk->owner->bins[cls];
+  block_t* const block = static_cast<block_t*>(ptr);
+
+  if (chunk->owner == current_heap) {
+    block->next = bin.local;
+    bin.local = block;
+  } else if (thread_exiting) {
+    // Nothing will return collected blocks anymore.
+    push_remote(bin, block, block);
+  } else {
+    heap_t::bin_t& own = thread_heap()->bins[cls];
+    // Blocks of a single heap are collected at a time.
+    if (own.outgoing.target != &bin) {
+      flush_outgoing(own);
+      own.outgoing.target = &bin;
+      own.outgoing.last = block;
+    }
+    block->next = own.outgoing.first;
+    own.outgoing.first = block;
+
+    if (++own.outgoing.count == REMOTE_BATCH) {
+      flush_outgoing(own);
+    }
+  }
+}
+
+message_allocator hook{&pool_allocate, &pool_deallocate};
+
+/// States of the hook.
+/// The hook can be replaced until the first envelope is allocated,
+/// so every envelope is freed by the allocator it was allocated with.
+enum : int { HOOK_OPEN, HOOK_CHANGING, HOOK_SEALED };
+
+std::atomic<int> hook_state{HOOK_OPEN};
+
+/// Forbids replacing of the hook.
+void seal_hook() noexcept {
+  int state = hook_state.load(std::memory_order_acquire);
+
+  while (state != HOOK_SEALED) {
+    if (state == HOOK_CHANGING) {
+      // Wait for the hook to be replaced.
+      std::this_thread::yield();
+      state = hook_state.load(std::memory_order_acquire);
+    } else if (hook_state.compare_exchange_weak(state, HOOK_SEALED,
+                                                std::memory_order_acq_rel))
+    {
+      return;
+    }
+  }
+}
+
+} // namespace
+
+void* msg_t::operator new(const size_t size) {
+  if (hook_state.load(std::memory_order_acquire) != HOOK_SEALED) [[unlikely]]
+  {
+    seal_hook();
+  }
+  return hook.allocate(size);
+}
+
+void* msg_t::operator new(const size_t size, const std::align_val_t al) {
+  return ::operator new(size, al);
+}
+
+void msg_t::operator delete(void* const ptr, const size_t size) noexcept {
+  hook.deallocate(ptr, size);
+}
+
+void msg_t::operator delete(void* const ptr,
+                            const size_t size,
+                            const std::align_val_t al) noexcept {
+  ::operator delete(ptr, size, al);
+}
+
+} // namespace core
+
+bool set_message_allocator(const message_allocator& alloc) {
+  assert(bool(alloc.allocate) == bool(alloc.deallocate));
+
+  int state = core::HOOK_OPEN;
+  // Envelopes allocated before must be freed by the current allocator.
+  if (!core::hook_state.compare_exchange_strong(state, core::HOOK_CHANGING,
+                                                std::memory_order_acquire))
+  {
+    return false;
+  }
+
+  if (alloc.allocate && alloc.deallocate) {
+    core::hook = alloc;
+  } else {
+    core::hook = default_message_allocator();
+  }
+
+  core::hook_state.store(core::HOOK_OPEN, std::memory_order_release);
+  return true;
+}
+
+message_allocator default_message_allocator() noexcept {
+  return {&core::pool_allocate, &core::pool_deallocate};
+}
+
+} // namespace acto
@@ -1,46 +1,210 @@
 #include "acto/event.h"
 
+#include <climits>
+#include <thread>
+
+#if defined(__linux__)
+# include <linux/futex.h>
+# include <sys/syscall.h>
+# include <time.h>
+# include <unistd.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86)
+# include <immintrin.h>
+#endif
+
 namespace acto::core {
+namespace {
+
+/// The event is in signaled state.
+constexpr uint32_t SIGNALED = 1;
+/// Increment of the parked threads counter.
+constexpr uint32_t WAITER = 2;
+
+void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(_M_X64) || defined(_M_IX86)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#else
+  std::this_thread::yield();
+#endif
+}
+
+#if defined(__linux__)
+void futex_wait(std::atomic<uint32_t>* addr,
+                const uint32_t expected,
+                const timespec* timeout) noexcept {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE,
+          expected, timeout, nullptr, 0);
+}
+
+void futex_wake(std::atomic<uint32_t>* addr, const int count) noexcept {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE,
+          count, nullptr, nullptr, 0);
+}
+#endif
+
+} // namespace
 
-event::event(const bool auto_reset)
+event::event(const bool auto_reset, const std::chrono::nanoseconds spin)
   : auto_(auto_reset)
-  , triggered_(false) {
+  , spin_(spin) {
 }
 
 void event::reset() {
-  std::lock_guard g(mutex_);
-
-  triggered_ = false;
+  state_.fetch_and(~SIGNALED);
 }
 
 void event::signaled() {
-  std::lock_guard g(mutex_);
+#if defined(__linux__)
+  const int count = auto_ ? 1 : INT_MAX;
+  const uint32_t prev = state_.fetch_or(SIGNALED);
+  // The waiter may destroy the event right after observing the signaled
+  // state, so the object should not be touched after the update.
+  // Waking a stale address is harmless for futex.
+  if ((prev & SIGNALED) == 0 && prev >= WAITER) {
+    futex_wake(&state_, count);
+  }
+#else
+  uint32_t prev = state_.load();
+
+  do {
+    if (prev & SIGNALED) {
+      return;
+    }
+    // Parked threads can leave the wait only under the mutex.
+    if (prev >= WAITER) {
+      std::lock_guard g(mutex_);
 
-  triggered_ = true;
-  cond_.notify_one();
+      state_.fetch_or(SIGNALED);
+      if (auto_) {
+        cond_.notify_one();
+      } else {
+        cond_.notify_all();
+      }
+      return;
+    }
+  } while (!state_.compare_exchange_weak(prev, prev | SIGNALED));
+#endif
 }
 
 wait_result event::wait() {
-  std::unique_lock g(mutex_);
+  if (spin_wait()) {
+    return wait_result::signaled;
+  }
 
-  cond_.wait(g, [this] { return triggered_; });
+  return park(nullptr);
+}
 
-  triggered_ = !auto_;
+wait_result event::wait(const std::chrono::nanoseconds duration) {
+  const auto deadline = std::chrono::steady_clock::now() + duration;
+
+  if (spin_wait()) {
+    return wait_result::signaled;
+  }
 
-  return wait_result::signaled;
+  return park(&deadline);
 }
 
-wait_result event::wait(const std::chrono::nanoseconds duration) {
-  const auto deadline = std::chrono::high_resolution_clock::now() + duration;
+bool event::try_acquire() noexcept {
+  uint32_t cur = state_.load(std::memory_order_acquire);
+
+  while (cur & SIGNALED) {
+    if (!auto_) {
+      return true;
+    }
+    if (state_.compare_exchange_weak(cur, cur & ~SIGNALED,
+                                     std::memory_order_acquire))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool event::spin_wait() noexcept {
+  if (try_acquire()) {
+    return true;
+  }
+  if (spin_.count() <= 0) {
+    return false;
+  }
+
+  const auto deadline = std::chrono::steady_clock::now() + spin_;
+
+  do {
+    // Read the clock only once per a batch of iterations.
+    for (int i = 0; i < 64; ++i) {
+      cpu_relax();
+
+      if (try_acquire()) {
+        return true;
+      }
+    }
+  } while (std::chrono::steady_clock::now() < deadline);
+
+  return false;
+}
+
+wait_result event::park(
+  const std::chrono::steady_clock::time_point* deadline) {
+  wait_result result = wait_result::signaled;
+
+#if defined(__linux__)
+  state_.fetch_add(WAITER);
+
+  while (!try_acquire()) {
+    const uint32_t cur = state_.load();
+
+    if (cur & SIGNALED) {
+      continue;
+    }
+    if (deadline) {
+      const auto left = *deadline - std::chrono::steady_clock::now();
+
+      if (left <= std::chrono::steady_clock::duration::zero()) {
+        result = wait_result::timeout;
+        break;
+      }
+
+      const auto ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+      timespec ts;
+
+      ts.tv_sec = time_t(ns / 1000000000);
+      ts.tv_nsec = long(ns % 1000000000);
+
+      futex_wait(&state_, cur, &ts);
+    } else {
+      futex_wait(&state_, cur, nullptr);
+    }
+  }
+
+  state_.fetch_sub(WAITER);
+#else
   std::unique_lock g(mutex_);
 
-  if (!cond_.wait_until(g, deadline, [this] { return triggered_; })) {
-    return wait_result::timeout;
+  state_.fetch_add(WAITER);
+
+  while (!try_acquire()) {
+    if (!deadline) {
+      cond_.wait(g);
+    } else if (cond_.wait_until(g, *deadline) == std::cv_status::timeout) {
+      if (!try_acquire()) {
+        result = wait_result::timeout;
+      }
+      break;
+    }
   }
 
-  triggered_ = !auto_;
+  state_.fetch_sub(WAITER);
+#endif
 
-  return wait_result::signaled;
+  return result;
 }
 
 } // namespace acto::core
@@ -1,6 +1,8 @@
 #include "runtime.h"
 #include "worker.h"
 
+#include <algorithm>
+
 namespace acto::core {
 namespace {
 
@@ -12,60 +14,249 @@ struct binding_context_t {
   /// implicitly determine a sender for a message.
   object_t* active_actor{nullptr};
 
-  /// Set of actors binded to the current thread.
-  std::unordered_set<object_t*> actors;
+  /// Actors binded to the current thread in the order of creation.
+  std::vector<object_t*> actors;
+
+  /// Index of the actor to take the next turn.
+  size_t next_actor{0};
+
+  /// Worker object if it is a worker thread created by the library.
+  worker_t* worker{nullptr};
+
+  /// Runtime the worker thread belongs to.
+  runtime_t* runtime{nullptr};
+
+  /// Number of objects retrieved by the worker from run queues.
+  unsigned int pops{0};
+
+  /// Nesting level of blocking sections.
+  unsigned int blocking{0};
+
+  /// Number of objects taken in a row from the worker's next slot.
+  unsigned int chain{0};
+
+  /// State of the random number generator used to select victims for
+  /// stealing.
+  uint32_t seed{0};
+
+  /// Nesting level of process_actors() calls.
+  unsigned int processing{0};
+
+  /// References to objects acquired in advance or released lazily.
+  struct reference_t {
+    object_t* obj;
+    /// Number of references held by the thread.
+    unsigned long pending;
+  };
+
+  /// Small cache of references, so sending and handling a series of
+  /// messages does not touch the reference counters of the objects
+  /// on each message.
+  reference_t references[16];
+  unsigned int reference_count{0};
+
+  /// Whether releasing of references can be deferred.
+  /// The cache is flushed at the end of a time slice, so it is used only
+  /// by worker threads and during processing of bound actors.
+  bool can_defer() const noexcept {
+    return worker != nullptr || processing != 0;
+  }
+
+  reference_t* find_reference(const object_t* const obj) noexcept {
+    for (unsigned int i = 0; i < reference_count; ++i) {
+      if (references[i].obj == obj) {
+        return &references[i];
+      }
+    }
+    return nullptr;
+  }
 
-  /// It is a worker thread created by the library.
-  bool is_worker_thread{false};
+  /// Adds a new entry if there is room in the cache.
+  bool add_reference(object_t* const obj, const unsigned long pending) {
+    if (reference_count == std::size(references)) {
+      return false;
+    }
+    references[reference_count++] = reference_t{obj, pending};
+    return true;
+  }
 
   ~binding_context_t() {
+    // Release references immediately from now on.
+    worker = nullptr;
     // Mark all actors as deleting to prevent message loops.
     for (auto* obj : actors) {
-      runtime_t::instance()->deconstruct_object(obj);
+      obj->runtime->deconstruct_object(obj);
     }
 
-    process_actors(true);
+    delete_actors(nullptr);
+
+    runtime_t::flush_references();
   }
 
   /**
-   * Processes all available messages for the actors.
+   * Gives the actors turns in round-robin order.
+   *
+   * An actor handles only the messages it had received before its turn
+   * began, so actors sending messages to themselves or to each other
+   * cannot keep the thread busy forever.
    *
-   * @param need_delete delete actors after process all messages.
+   * @param budget limits of the call or null for a single round.
    * @return true if at least one message has been processed.
    */
-  bool process_actors(const bool need_delete) {
-    auto runtime = runtime_t::instance();
-    bool something_was_processed = false;
-    // TODO: - switch between active actors to balance message processing.
-    //       - detect message loop.
-    for (auto ai = actors.cbegin(); ai != actors.cend(); ++ai) {
-      while (auto msg = (*ai)->select_message()) {
-        runtime->handle_message(*ai, std::move(msg));
-        something_was_processed = true;
+  bool process_actors(const this_thread::process_budget* const budget) {
+    using clock = std::chrono::steady_clock;
+
+    const bool timed = budget && budget->time.count() > 0;
+    const clock::time_point deadline =
+      timed ? clock::now() + budget->time : clock::time_point();
+    const size_t limit =
+      (budget && budget->messages) ? budget->messages : SIZE_MAX;
+    // Number of turns in a single round.
+    const size_t round = actors.size();
+    size_t handled = 0;
+    size_t turns = 0;
+    // Number of turns in a row without any messages.
+    size_t idle = 0;
+    bool exhausted = false;
+
+    ++processing;
+    while (!exhausted && idle < actors.size()) {
+      if (!budget && turns == round) {
+        break;
+      }
+      if (next_actor >= actors.size()) {
+        next_actor = 0;
       }
-      {
-        std::lock_guard<std::mutex> g((*ai)->cs);
-        (*ai)->scheduled = false;
+
+      object_t* const obj = actors[next_actor++];
+      size_t count = 0;
+
+      ++turns;
+      // Messages received during the turn are left for the next one.
+      for (bool refill = true; handled < limit; refill = false) {
+        auto msg = obj->select_message(refill);
+
+        if (!msg) {
+          break;
+        }
+        obj->runtime->handle_message(obj, std::move(msg));
+        ++handled;
+        ++count;
+
+        if (timed && clock::now() >= deadline) {
+          exhausted = true;
+          break;
+        }
+      }
+      exhausted |= (handled == limit);
+
+      const uint32_t state = obj->unschedule();
+      // The object has been destroyed while its messages were handled,
+      // so the deconstruction was left to the thread.
+      if (count && state == object_t::DELETING) {
+        obj->runtime->deconstruct_object(obj);
       }
-      if (need_delete) {
-        runtime->deconstruct_object(*ai);
+      // The state is restored if there are some messages left.
+      if ((state & object_t::SCHEDULED) || count) {
+        idle = 0;
+      } else {
+        ++idle;
       }
     }
 
-    if (need_delete) {
-      for (auto ai = actors.cbegin(); ai != actors.cend(); ++ai) {
-        runtime->release(*ai);
+    if (--processing == 0) {
+      runtime_t::flush_references();
+    }
+
+    return handled != 0;
+  }
+
+  /**
+   * Processes all available messages for the actors and deletes them.
+   *
+   * @param owner process only actors of the given runtime if not null.
+   */
+  void delete_actors(runtime_t* const owner) {
+    ++processing;
+    for (size_t i = 0; i < actors.size(); ++i) {
+      object_t* const obj = actors[i];
+      runtime_t* const rt = obj->runtime;
+
+      if (owner && owner != rt) {
+        continue;
       }
+      do {
+        while (auto msg = obj->select_message()) {
+          rt->handle_message(obj, std::move(msg));
+        }
+      } while (obj->unschedule() & object_t::SCHEDULED);
+
+      rt->deconstruct_object(obj);
+    }
+
+    const auto ai = std::stable_partition(
+      actors.begin(), actors.end(), [owner](object_t* const obj) {
+        return owner && owner != obj->runtime;
+      });
 
-      actors.clear();
+    for (auto it = ai; it != actors.end(); ++it) {
+      (*it)->runtime->release(*it);
     }
+    actors.erase(ai, actors.end());
+    next_actor = 0;
 
-    return something_was_processed;
+    if (--processing == 0) {
+      runtime_t::flush_references();
+    }
   }
 };
 
 static thread_local binding_context_t thread_context;
 
+/// The global queue is checked first on each N-th retrieval of an object,
+/// so objects scheduled from outside of worker threads are not starved by
+/// the objects circulating in local queues.
+static constexpr unsigned int GLOBAL_QUEUE_INTERVAL = 61;
+
+/// Cheap thread local xorshift generator.
+static uint32_t next_random() noexcept {
+  uint32_t x = thread_context.seed;
+
+  if (x == 0) {
+    x = uint32_t(std::hash<const void*>()(&thread_context)) | 1;
+  }
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+
+  return thread_context.seed = x;
+}
+
+/// Jump consistent hash by Lamping and Veach.
+/// Maps the key to one of n buckets, so only 1/n of keys move to
+/// a new bucket when the number of buckets grows.
+static size_t jump_hash(uint64_t key, const size_t n) noexcept {
+  int64_t b = -1;
+  int64_t j = 0;
+
+  while (j < int64_t(n)) {
+    b = j;
+    key = key * 2862933555777941757ULL + 1;
+    j = int64_t(double(b + 1) * (double(1LL << 31) / double((key >> 33) + 1)));
+  }
+
+  return size_t(b);
+}
+
+/// Header of a frame of a coroutine.
+/// Keeps the default alignment of the frame.
+struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) frame_header_t {
+  /// Actor the frame is cached by. Can be null.
+  actor* owner;
+  /// Size of the frame.
+  size_t size;
+};
+
 class active_actor_guard {
 public:
   explicit active_actor_guard(object_t* value) noexcept
@@ -83,13 +274,72 @@ private:
 
 } // namespace
 
-runtime_t::runtime_t()
-  : m_scheduler(&runtime_t::execute, this) {
+/// Config for the runtime instance.
+static struct {
+  std::mutex mutex;
+  runtime_config config;
+  bool started{false};
+} instance_config;
+
+/// Adjusts the config to consistent values.
+static runtime_config normalize_config(runtime_config config) {
+  if (config.concurrency == 0) {
+    config.concurrency = config.cpus.empty()
+                         ? std::max(1u, std::thread::hardware_concurrency())
+                         : unsigned(config.cpus.size());
+  }
+  config.max_workers = std::max({1u, config.max_workers, config.min_workers});
+  config.slice_check_interval = std::max(1u, config.slice_check_interval);
+  config.concurrency = std::min(config.concurrency, config.max_workers);
+  config.timer_tick = std::max(config.timer_tick, std::chrono::nanoseconds(1));
+
+  return config;
+}
+
+/// Groups allowed CPUs by NUMA nodes.
+static std::vector<std::vector<unsigned int>> make_topology(
+  const runtime_config& config) {
+  std::vector<std::vector<unsigned int>> result;
+
+  if (config.numa_aware) {
+    for (auto& cpus : numa_nodes()) {
+      if (!config.cpus.empty()) {
+        std::erase_if(cpus, [&](const unsigned int cpu) {
+          return std::find(config.cpus.begin(), config.cpus.end(), cpu) ==
+                 config.cpus.end();
+        });
+      }
+      if (!cpus.empty()) {
+        result.push_back(std::move(cpus));
+      }
+    }
+  }
+  if (result.empty()) {
+    result.push_back(config.cpus);
+  }
+
+  return result;
+}
+
+runtime_t::runtime_t(const runtime_config& config)
+  : config_(normalize_config(config))
+  , m_processors(config_.concurrency)
+  , topology_(make_topology(config_))
+  , nodes_(new node_t[topology_.size()])
+  , m_scheduler(&runtime_t::execute, this) {
   no_actors_event_.signaled();
   no_workers_event_.signaled();
 }
 
 runtime_t::~runtime_t() {
+  stop();
+}
+
+void runtime_t::stop() {
+  if (!m_scheduler.joinable()) {
+    return;
+  }
+
   terminating_ = true;
   // Дождаться, когда все потоки будут удалены
   queue_event_.signaled();
@@ -99,18 +349,153 @@ runtime_t::~runtime_t() {
 
   queue_event_.signaled();
   // Stop scheduler's thread.
-  if (m_scheduler.joinable()) {
-    m_scheduler.join();
-  }
+  m_scheduler.join();
+
+  timers_.stop();
 
   assert(workers_.count == 0 && workers_.reserved == 0);
 }
 
+runtime_t* runtime_t::current() {
+  if (object_t* const active = thread_context.active_actor) {
+    return active->runtime;
+  }
+  if (thread_context.runtime) {
+    return thread_context.runtime;
+  }
+  return instance();
+}
+
+void runtime_t::ref() noexcept {
+  ++references_;
+}
+
+void runtime_t::unref() noexcept {
+  if (--references_ == 0) {
+    delete this;
+  }
+}
+
+void runtime_t::leave_blocking() {
+  assert(thread_context.blocking && thread_context.runtime == this);
+
+  if (--thread_context.blocking) {
+    return;
+  }
+
+  --workers_.blocked;
+  // The compensating worker is not needed anymore.
+  ++workers_.retiring;
+  queue_event_.signaled();
+}
+
 runtime_t* runtime_t::instance() {
-  static runtime_t value;
+  static runtime_t value([] {
+    std::lock_guard g(instance_config.mutex);
+
+    instance_config.started = true;
+    return instance_config.config;
+  }());
   return &value;
 }
 
+bool runtime_t::configure(const runtime_config& config) {
+  std::lock_guard g(instance_config.mutex);
+
+  if (instance_config.started) {
+    return false;
+  }
+
+  instance_config.config = config;
+  return true;
+}
+
+runtime_t* runtime_t::enter_blocking() {
+  runtime_t* const rt = thread_context.runtime;
+  worker_t* const worker = thread_context.worker;
+  object_t* const active = thread_context.active_actor;
+  // Dedicated threads do not belong to the pool.
+  if (!rt || !worker || (active && active->exclusive)) {
+    return nullptr;
+  }
+  if (thread_context.blocking++) {
+    return rt;
+  }
+
+  ++rt->workers_.blocked;
+  // Nobody serves the local queue while the worker is blocked,
+  // so move its objects to the global queue.
+  if (run_queue_t* const local = worker->queue()) {
+    object_queue_t& global = rt->nodes_[worker->node()].queue;
+
+    if (object_t* const obj = local->next.exchange(nullptr)) {
+      global.push(obj);
+    }
+    while (object_t* const obj = local->pop()) {
+      global.push(obj);
+    }
+  }
+  // Let the scheduler to provide a compensating worker.
+  rt->queue_event_.signaled();
+
+  return rt;
+}
+
+void runtime_t::acquire_sender(object_t* const obj) noexcept {
+  /// Number of references acquired at once for a sender of a series of
+  /// messages.
+  static constexpr unsigned long BATCH = 16;
+
+  assert(obj && obj->references);
+
+  auto& ctx = thread_context;
+
+  if (ctx.can_defer()) {
+    if (auto* ref = ctx.find_reference(obj)) {
+      if (ref->pending == 0) {
+        obj->references.fetch_add(BATCH);
+        ref->pending = BATCH;
+      }
+      --ref->pending;
+      return;
+    }
+    // Start tracking the object without an advance.
+    // Most actors send a single message in response to a message.
+    ctx.add_reference(obj, 0);
+  }
+  ++obj->references;
+}
+
+void runtime_t::release_deferred(object_t* const obj) {
+  auto& ctx = thread_context;
+
+  if (ctx.can_defer()) {
+    if (auto* ref = ctx.find_reference(obj)) {
+      ++ref->pending;
+      return;
+    }
+    if (ctx.add_reference(obj, 1)) {
+      return;
+    }
+  }
+  obj->runtime->release(obj);
+}
+
+void runtime_t::flush_references() {
+  auto& ctx = thread_context;
+  // Releasing of a reference may destroy an actor, which in turn may
+  // release references to other objects. Such references are appended
+  // to the cache and released by the same loop.
+  for (unsigned int i = 0; i < ctx.reference_count; ++i) {
+    object_t* const obj = std::exchange(ctx.references[i].obj, nullptr);
+
+    if (const auto pending = ctx.references[i].pending) {
+      obj->runtime->release(obj, pending);
+    }
+  }
+  ctx.reference_count = 0;
+}
+
 unsigned long runtime_t::acquire(object_t* const obj) const noexcept {
   assert(bool(obj) && obj->references);
   return ++obj->references;
@@ -119,12 +504,30 @@ unsigned long runtime_t::acquire(object_t* const obj) const noexcept {
 void runtime_t::deconstruct_object(object_t* const obj) {
   assert(obj);
 
+  bool deconstructed = false;
+
   {
     std::lock_guard<std::mutex> g(obj->cs);
 
-    obj->deleting = true;
-    // The object still has some messages in the mailbox.
-    if (obj->scheduled) {
+    const uint32_t state = obj->state.fetch_or(object_t::DELETING);
+    // Let blocked senders know the message will not be delivered.
+    if (obj->blocked_senders.load()) {
+      obj->space_event.signaled();
+    }
+    // The object still has some messages in the mailbox or some messages
+    // are being sent to it. The object will be deconstructed by a worker
+    // after the messages have been processed.
+    if (state & ~object_t::DELETING) {
+      // The dedicated thread may wait for messages, so let it notice
+      // the object is being deleted.
+      if (obj->thread && !(state & object_t::DELETING)) {
+        obj->thread->wakeup();
+      }
+      return;
+    }
+    // A worker is about to take the object back as the messages have
+    // arrived right after the worker had released it.
+    if (!obj->binded && obj->has_messages()) {
       return;
     }
     //
@@ -133,7 +536,21 @@ void runtime_t::deconstruct_object(object_t* const obj) {
       // function during deleteing the object's body.
       obj->references++;
 
-      delete obj->impl, obj->impl = nullptr;
+      // The thread will not process messages of the bound actor anymore,
+      // so the suspended handler is just destroyed.
+      if (const auto h = std::exchange(obj->impl->awaiting_, nullptr)) {
+        obj->suspension.store(0);
+        h.destroy();
+        obj->impl->awaiting_msg_.reset();
+      }
+
+      // A body placed into an arena only needs to be destructed.
+      if (obj->arena) {
+        obj->impl->~actor();
+      } else {
+        delete obj->impl;
+      }
+      obj->impl = nullptr;
 
       if (obj->waiters) {
         for (object_t::waiter_t* it = obj->waiters; it != nullptr;) {
@@ -148,26 +565,21 @@ void runtime_t::deconstruct_object(object_t* const obj) {
       }
 
       obj->references--;
+
+      deconstructed = true;
     }
-    // The didicated thread will place itself into shared pool.
+    // The dedicated thread is deleting the object itself, it will place
+    // itself into the shared pool afterwards.
     if (obj->thread) {
       --workers_.reserved;
-      obj->thread->wakeup();
       obj->thread = nullptr;
     }
   }
 
-  const bool is_binded = obj->binded;
-
-  // Remove object from the global registry.
-  if (!is_binded) {
-    std::lock_guard<std::mutex> g(mutex_);
-
-    if (actors_.erase(obj)) {
-      if (actors_.empty()) {
-        no_actors_event_.signaled();
-      }
-    }
+  // Remove object from the registry.
+  // Objects bound to a thread are not registered.
+  if (deconstructed && obj->registry_shard <= registry_.mask) {
+    unregister_object(obj);
   }
 
   {
@@ -180,7 +592,31 @@ void runtime_t::deconstruct_object(object_t* const obj) {
 
   // There are no more references to the object,
   // so delete it.
-  delete obj;
+  if (obj->router) {
+    delete_router(obj);
+  }
+  if (reply_t* const reply = obj->reply) {
+    uint32_t pending = reply_t::PENDING;
+    // Nobody can reply to the request anymore.
+    if (reply->state.compare_exchange_strong(pending, reply_t::BROKEN)) {
+      reply->done.signaled();
+
+      if (object_t* const waiter = reply->waiter.exchange(nullptr)) {
+        resume_object(waiter);
+      }
+    }
+    reply->release();
+  } else if (arena_t* const arena = obj->arena) {
+    obj->~object_t();
+    // The last object of the arena releases its memory.
+    if (arena->references.fetch_sub(1) == 1) {
+      delete_arena(arena);
+    }
+  } else {
+    delete obj;
+  }
+  // Release the reference held by the object.
+  unref();
 }
 
 void runtime_t::handle_message(object_t* obj, std::unique_ptr<msg_t> msg) {
@@ -193,8 +629,7 @@ void runtime_t::handle_message(object_t* obj, std::unique_ptr<msg_t> msg) {
   }
 
   if (obj->impl->terminating_) {
-    std::lock_guard<std::mutex> g(obj->cs);
-    obj->deleting = true;
+    obj->state.fetch_or(object_t::DELETING);
   }
 }
 
@@ -220,15 +655,17 @@ void runtime_t::join(object_t* const obj) {
   node.on_deleted.wait();
 }
 
-bool runtime_t::process_binded_actors() {
-  return thread_context.process_actors(false);
+bool runtime_t::process_binded_actors(
+  const this_thread::process_budget* const budget) {
+  return thread_context.process_actors(budget);
 }
 
-unsigned long runtime_t::release(object_t* const obj) {
+unsigned long runtime_t::release(object_t* const obj,
+                                 const unsigned long count) {
   assert(obj);
-  assert(obj->references);
+  assert(obj->references >= count);
 
-  const long result = --obj->references;
+  const unsigned long result = (obj->references -= count);
 
   if (result == 0) {
     deconstruct_object(obj);
@@ -241,203 +678,1057 @@ bool runtime_t::send(object_t* const target, std::unique_ptr<msg_t> msg) {
   return send_on_behalf(target, thread_context.active_actor, std::move(msg));
 }
 
+bool runtime_t::try_send(object_t* const target, std::unique_ptr<msg_t> msg) {
+  return send_on_behalf(target, thread_context.active_actor, std::move(msg),
+                        true);
+}
+
 bool runtime_t::send_on_behalf(object_t* const target,
                                object_t* const sender,
-                               std::unique_ptr<msg_t> msg) {
+                               std::unique_ptr<msg_t> msg,
+                               const bool try_only) {
   assert(msg);
-  assert(target);
 
-  {
-    std::lock_guard<std::mutex> g(target->cs);
-    // Cannot send messages to deleting object.
-    if (target->deleting) {
-      return false;
-    }
-    // Acquire reference to a sender.
-    if (sender) {
-      msg->sender = sender;
-      acquire(sender);
-    }
-    // Enqueue the message.
-    target->enqueue(std::move(msg));
-    // Do not try to select a worker thread for a binded actor.
-    if (target->binded) {
-      target->scheduled = true;
-      return true;
-    }
-    // Wakeup object's thread if the target has
-    // a dedicated thread for message processing.
-    if (worker_t* const thread = target->thread) {
-      thread->wakeup();
-      return true;
-    }
-    if (target->scheduled) {
-      return true;
-    } else {
-      target->scheduled = true;
-    }
-  }
+  msg_t* const p = msg.release();
 
-  push_object(target);
+  return enqueue_messages(target, sender, p, p, 1, try_only);
+}
 
-  return true;
+bool runtime_t::send_batch(object_t* const target,
+                           msg_t* const first,
+                           msg_t* const last,
+                           const unsigned long count) {
+  return enqueue_messages(target, thread_context.active_actor, first, last,
+                          count, false);
 }
 
-void runtime_t::shutdown() {
-  // Process all messages for binded actors and stop them.
-  thread_context.process_actors(true);
+size_t runtime_t::multicast(std::span<const actor_ref> targets,
+                            shared_payload_t* const payload,
+                            const uint32_t type) {
+  object_t* const sender = thread_context.active_actor;
+  std::vector<object_t*> runnable;
+  size_t delivered = 0;
+  // A reference for each envelope and one held by the call.
+  unsigned long unused = 1;
 
-  // Process shared actors.
-  {
-    actors_set actors;
+  payload->references.store(targets.size() + 1);
 
-    {
-      std::lock_guard<std::mutex> g(mutex_);
+  for (const actor_ref& ref : targets) {
+    object_t* target = ref.object_;
 
-      if (actors_.empty()) {
-        return;
-      } else {
-        actors = actors_;
-      }
+    if (!target) {
+      ++unused;
+      continue;
     }
 
-    for (auto ai = actors.cbegin(); ai != actors.cend(); ++ai) {
-      deconstruct_object(*ai);
+    msg_t* const msg = new msg_shared_t(type, payload);
+
+    while (target && target->router) {
+      target = route(target, msg);
+    }
+    if (!target) {
+      delete msg;
+      continue;
     }
 
-    no_actors_event_.wait();
+    switch (target->runtime->post_messages(target, sender, msg, msg, 1,
+                                           false)) {
+      case post_result::rejected:
+        break;
+      case post_result::enqueued:
+        ++delivered;
+        break;
+      case post_result::runnable:
+        ++delivered;
+        runnable.push_back(target);
+        break;
+    }
+  }
+
+  if (payload->references.fetch_sub(unused) == unused) {
+    delete payload;
   }
+  schedule_runnable(runnable);
 
-  assert(actors_.empty());
+  return delivered;
 }
 
-object_t* runtime_t::make_instance(actor_ref context,
-                                   const actor_thread thread_opt,
-                                   std::unique_ptr<actor> body) {
-  assert(body);
-  // Create core object.
-  core::object_t* const result = create_actor(std::move(body), thread_opt);
+void runtime_t::schedule_runnable(const std::vector<object_t*>& runnable) {
+  // Schedule woken objects of each runtime at once.
+  for (auto ri = runnable.begin(); ri != runnable.end();) {
+    runtime_t* const rt = (*ri)->runtime;
+    const auto end = std::find_if(ri, runnable.end(), [rt](object_t* obj) {
+      return obj->runtime != rt;
+    });
 
-  if (result) {
-    active_actor_guard guard(result);
+    rt->schedule_batch(&*ri, size_t(end - ri));
+    ri = end;
+  }
+}
 
-    result->impl->context_ = std::move(context);
-    result->impl->self_ = actor_ref(result, true);
-    result->impl->bootstrap();
+bool runtime_t::enqueue_messages(object_t* const target,
+                                 object_t* const sender,
+                                 msg_t* const first,
+                                 msg_t* const last,
+                                 const unsigned long count,
+                                 const bool try_only) {
+  // The messages go directly to a routee.
+  if (target->router) [[unlikely]] {
+    if (object_t* const routee = route(target, first)) {
+      return routee->runtime->enqueue_messages(routee, sender, first, last,
+                                               count, try_only);
+    }
+    delete_messages(first, last);
+    return false;
   }
 
-  return result;
+  switch (post_messages(target, sender, first, last, count, try_only)) {
+    case post_result::rejected:
+      return false;
+    case post_result::enqueued:
+      return true;
+    case post_result::runnable:
+      push_object(target);
+      return true;
+  }
+  return false;
 }
 
-object_t* runtime_t::create_actor(std::unique_ptr<actor> body,
-                                  const actor_thread thread_opt) {
-  object_t* const result = new core::object_t(thread_opt, std::move(body));
-  // Bind actor to the current thread if the thread did not created by the
-  // library.
-  if (thread_opt == actor_thread::bind && !thread_context.is_worker_thread) {
-    result->references += 1;
-    thread_context.actors.insert(result);
-  } else {
-    {
-      std::lock_guard<std::mutex> g(mutex_);
+void runtime_t::wakeup_thread(object_t* const obj) {
+  std::lock_guard<std::mutex> g(obj->cs);
+
+  if (obj->thread) {
+    obj->thread->wakeup();
+  }
+}
 
-      actors_.insert(result);
+runtime_t::post_result runtime_t::post_messages(object_t* const target,
+                                                object_t* const sender,
+                                                msg_t* const first,
+                                                msg_t* const last,
+                                                const unsigned long count,
+                                                const bool try_only) {
+  assert(target);
+  assert(first && last && count);
 
-      no_actors_event_.reset();
+  // The reply is stored into the slot of the request.
+  if (target->reply) [[unlikely]] {
+    return complete_reply(target, first, last, count)
+           ? post_result::enqueued
+           : post_result::rejected;
+  }
+
+  // Reserve room in a bounded mailbox.
+  if (target->capacity && !reserve_slot(target, try_only, count)) {
+    delete_messages(first, last);
+    return post_result::rejected;
+  }
+  // Count the messages for routers observing the size of the mailbox.
+  const bool counted =
+    !target->capacity && target->observers.load(std::memory_order_relaxed);
+
+  if (counted) [[unlikely]] {
+    target->queued.fetch_add(count);
+
+    for (msg_t* p = first;; p = p->next) {
+      p->counted = true;
+      if (p == last) {
+        break;
+      }
     }
-    // Create dedicated thread for the actor if necessary.
-    if (thread_opt == actor_thread::exclusive) {
-      worker_t* const worker = create_worker();
+  }
 
-      result->scheduled = true;
-      result->thread = worker;
+  // Register the sender, so the object will not be deconstructed
+  // until the messages are enqueued.
+  uint32_t state = target->state.fetch_add(object_t::SENDER);
 
-      ++workers_.reserved;
+  // Cannot send messages to deleting object.
+  if (state & object_t::DELETING) {
+    delete_messages(first, last);
 
-      worker->assign(result, std::chrono::milliseconds(500));
+    if (target->capacity || counted) {
+      target->queued.fetch_sub(count);
+    }
+    // Complete deconstruction of the object if it has been postponed
+    // because of the sender. The dedicated thread stays with the object
+    // until it completes the deconstruction itself.
+    state = target->state.fetch_sub(object_t::SENDER) - object_t::SENDER;
+    if (state == object_t::DELETING) {
+      if (target->exclusive) {
+        wakeup_thread(target);
+      } else {
+        deconstruct_object(target);
+      }
+    }
+    return post_result::rejected;
+  }
+  // Acquire references to a sender.
+  if (sender) {
+    if (count == 1) {
+      acquire_sender(sender);
+    } else {
+      sender->references.fetch_add(count);
+    }
+    for (msg_t* p = first;; p = p->next) {
+      p->sender = sender;
+      if (p == last) {
+        break;
+      }
     }
   }
+  // Enqueue the messages.
+  target->enqueue(first, last);
+  // Wakeup object's thread if the target has a dedicated thread for
+  // message processing. The object is not deconstructed while the sender
+  // is registered, so the thread cannot be returned to the pool meanwhile.
+  worker_t* const thread = target->exclusive ? target->thread : nullptr;
+
+  if (thread) {
+    thread->wakeup();
+  }
+  // Unregister the sender and mark the object as scheduled at once.
+  state += object_t::SENDER;
+  while (!target->state.compare_exchange_weak(
+    state, (state - object_t::SENDER) | object_t::SCHEDULED))
+  { }
+  if (thread) {
+    // The thread might have tried to complete the deconstruction while
+    // the sender was registered, so let it try again.
+    if (state & object_t::DELETING) [[unlikely]] {
+      wakeup_thread(target);
+    }
+    return post_result::enqueued;
+  }
+  // The object is already in a queue or is being processed.
+  if (state & object_t::SCHEDULED) {
+    return post_result::enqueued;
+  }
+  // Do not try to select a worker thread for a binded actor.
+  if (target->binded) {
+    return post_result::enqueued;
+  }
 
-  return result;
+  return post_result::runnable;
 }
 
-worker_t* runtime_t::create_worker() {
-  worker_t* const result =
-    new core::worker_t(this, [] { thread_context.is_worker_thread = true; });
+object_t* runtime_t::route(object_t* const target, const msg_t* const msg) {
+  router_t* const router = target->router;
+  const auto& routees = router->routees;
+  const size_t n = routees.size();
 
-  if (++workers_.count == 1) {
-    no_workers_event_.reset();
+  if (n == 0 || (target->state.load() & object_t::DELETING)) {
+    return nullptr;
   }
 
-  return result;
-}
+  switch (router->strategy) {
+    case routing_strategy::round_robin:
+      break;
+    case routing_strategy::random:
+      return routees[size_t((uint64_t(next_random()) * n) >> 32)];
+    case routing_strategy::smallest_mailbox: {
+      // Start from a random routee to spread messages over routees
+      // with mailboxes of the same size.
+      size_t i = size_t((uint64_t(next_random()) * n) >> 32);
+      object_t* result = routees[i];
+      unsigned long size = result->queued.load(std::memory_order_relaxed);
+
+      for (size_t k = 1; k < n && size != 0; ++k) {
+        if (++i == n) {
+          i = 0;
+        }
 
-void runtime_t::execute() {
-  auto last_cleanup_time = std::chrono::steady_clock::now();
-  auto new_worker_timeout = std::chrono::seconds(2);
+        const unsigned long s =
+          routees[i]->queued.load(std::memory_order_relaxed);
 
-  auto delete_worker = [this](worker_t* const item) {
-    delete item;
-    // Уведомить, что удалены все вычислительные потоки
-    if (--workers_.count == 0) {
-      no_workers_event_.signaled();
+        if (s < size) {
+          result = routees[i];
+          size = s;
+        }
+      }
+      return result;
     }
-  };
+    case routing_strategy::consistent_hash: {
+      const auto& keys = router->keys.keys_;
 
-  while (active_) {
-    while (!queue_.empty()) {
-      // Прежде чем извлекать объект из очереди, необходимо проверить,
-      // что есть вычислительные ресурсы для его обработки
-      worker_t* worker = workers_.idle.pop();
+      if (msg->type < keys.size() && keys[msg->type]) {
+        return routees[jump_hash((*keys[msg->type])(msg), n)];
+      }
+      break;
+    }
+  }
+
+  const uint64_t next = router->next.fetch_add(1, std::memory_order_relaxed);
+
+  return routees[size_t(next % n)];
+}
+
+bool runtime_t::complete_reply(object_t* const target,
+                               msg_t* const first,
+                               msg_t* const last,
+                               const unsigned long count) {
+  reply_t* const reply = target->reply;
+  uint32_t pending = reply_t::PENDING;
+
+  if (count != 1 || first->type != reply->type ||
+      (target->state.load() & object_t::DELETING) ||
+      !reply->state.compare_exchange_strong(pending, reply_t::CLAIMED))
+  {
+    delete_messages(first, last);
+    return false;
+  }
+
+  reply->msg = first;
+  reply->state.store(reply_t::REPLIED);
+  reply->done.signaled();
+  // Resume the handler awaiting the reply.
+  if (object_t* const waiter = reply->waiter.exchange(nullptr)) {
+    resume_object(waiter);
+  }
+
+  return true;
+}
+
+object_t* runtime_t::suspend_active(const std::coroutine_handle<> h) {
+  object_t* const obj = thread_context.active_actor;
+
+  if (!obj || !obj->impl) {
+    return nullptr;
+  }
+  // Only one handler of the actor may be suspended at a time.
+  assert(!obj->impl->awaiting_);
+
+  obj->impl->awaiting_ = h;
+  obj->references++;
+  obj->suspension.store(object_t::AWAITING);
+  // Postpone deconstruction of the object until the handler completes.
+  // The thread of a bound object just destroys the handler.
+  if (!obj->binded) {
+    obj->state.fetch_or(object_t::SUSPENDED);
+  }
+
+  return obj;
+}
+
+void runtime_t::cancel_suspension(object_t* const obj) {
+  obj->state.fetch_and(~object_t::SUSPENDED);
+  obj->suspension.store(0);
+  obj->impl->awaiting_ = nullptr;
+  obj->runtime->release(obj);
+}
+
+void runtime_t::resume_object(object_t* const obj) {
+  if (make_resumable(obj)) {
+    obj->runtime->push_object(obj);
+  }
+  obj->runtime->release(obj);
+}
+
+bool runtime_t::make_resumable(object_t* const obj) {
+  uint32_t awaiting = object_t::AWAITING;
+  // The handler may have been destroyed along with the body.
+  if (!obj->suspension.compare_exchange_strong(awaiting,
+                                               object_t::RESUMABLE))
+  {
+    return false;
+  }
+
+  const uint32_t state = obj->state.fetch_or(object_t::SCHEDULED);
+
+  if (obj->exclusive) {
+    std::lock_guard<std::mutex> g(obj->cs);
+
+    if (worker_t* const thread = obj->thread) {
+      thread->wakeup();
+      return false;
+    }
+  }
+  // The object is already in a queue or is being processed.
+  // Bound objects are resumed by the next call to process_messages().
+  return !(state & object_t::SCHEDULED) && !obj->binded;
+}
+
+bool runtime_t::await_reply(reply_t* const reply,
+                            const std::coroutine_handle<> h) {
+  object_t* const obj = suspend_active(h);
+
+  if (!obj) {
+    blocking_guard guard;
+
+    reply->done.wait();
+    return false;
+  }
+
+  reply->waiter.store(obj);
+  // The request might have been completed before the waiter was set.
+  if (reply->state.load() > reply_t::CLAIMED && reply->waiter.exchange(nullptr))
+  {
+    cancel_suspension(obj);
+    return false;
+  }
+  return true;
+}
+
+bool runtime_t::await_delay(
+  const std::chrono::steady_clock::time_point deadline,
+  const std::coroutine_handle<> h) {
+  object_t* const obj = suspend_active(h);
+
+  if (!obj) {
+    blocking_guard guard;
+
+    std::this_thread::sleep_until(deadline);
+    return false;
+  }
+  if (!obj->runtime->timers_.add_resume(obj, deadline)) {
+    cancel_suspension(obj);
+    return false;
+  }
+  return true;
+}
+
+timer_entry_t* runtime_t::send_after(const actor_ref& target,
+                                     const std::chrono::nanoseconds delay,
+                                     std::unique_ptr<msg_t> msg) {
+  object_t* const obj = target.object_;
+
+  if (!obj) {
+    return nullptr;
+  }
+  obj->runtime->acquire(obj);
+  // References of the handle and of the wheel.
+  timer_entry_t* const entry = new timer_entry_t(obj, 2);
+
+  entry->msg = msg.release();
+  obj->runtime->timers_.add(entry, std::chrono::steady_clock::now() + delay,
+                            std::chrono::nanoseconds::zero());
+  return entry;
+}
+
+timer_entry_t* runtime_t::send_every(const actor_ref& target,
+                                     const std::chrono::nanoseconds period,
+                                     shared_payload_t* const payload,
+                                     const uint32_t type) {
+  object_t* const obj = target.object_;
+
+  if (!obj) {
+    delete payload;
+    return nullptr;
+  }
+  obj->runtime->acquire(obj);
+  // References of the handle and of the wheel.
+  timer_entry_t* const entry = new timer_entry_t(obj, 2);
+
+  payload->references.store(1);
+  entry->payload = payload;
+  entry->type = type;
+  obj->runtime->timers_.add(entry, std::chrono::steady_clock::now() + period,
+                            period);
+  return entry;
+}
+
+void runtime_t::fire_timers(std::vector<timer_entry_t*>& entries) {
+  std::vector<object_t*> runnable;
+  size_t rearmed = 0;
+
+  for (timer_entry_t* const entry : entries) {
+    object_t* const target = entry->target;
+
+    if (entry->resumes()) {
+      if (make_resumable(target)) {
+        runnable.push_back(target);
+      }
+      target->runtime->release(target);
+      delete entry;
+      continue;
+    }
+
+    uint32_t state = timer_entry_t::PENDING;
+
+    if (entry->period == 0) {
+      // The timer may have been cancelled since the slot was reached.
+      if (entry->state.compare_exchange_strong(state, timer_entry_t::DONE)) {
+        post_timer(target, std::exchange(entry->msg, nullptr), runnable);
+        timer_wheel_t::release_resources(entry);
+      }
+      timer_wheel_t::release(entry);
+      continue;
+    }
+    // The payload is kept while the message is being sent, so a concurrent
+    // cancel leaves releasing of the resources to this thread.
+    if (!entry->state.compare_exchange_strong(state, timer_entry_t::FIRING)) {
+      timer_wheel_t::release(entry);
+      continue;
+    }
+
+    entry->payload->references.fetch_add(1);
+
+    const bool alive = post_timer(
+      target, new msg_shared_t(entry->type, entry->payload), runnable);
+
+    state = timer_entry_t::FIRING;
+    if (alive &&
+        entry->state.compare_exchange_strong(state, timer_entry_t::PENDING))
+    {
+      entries[rearmed++] = entry;
+      continue;
+    }
+    // The timer has been cancelled meanwhile or the target is gone.
+    entry->state.store(timer_entry_t::DONE);
+    timer_wheel_t::release_resources(entry);
+    timer_wheel_t::release(entry);
+  }
+
+  entries.resize(rearmed);
+  schedule_runnable(runnable);
+}
+
+bool runtime_t::post_timer(object_t* const target,
+                           msg_t* const msg,
+                           std::vector<object_t*>& runnable) {
+  object_t* dest = target;
+
+  while (dest && dest->router) {
+    dest = route(dest, msg);
+  }
+  if (!dest) {
+    delete msg;
+    return false;
+  }
+
+  switch (dest->runtime->post_messages(dest, nullptr, msg, msg, 1, true)) {
+    case post_result::rejected:
+      // A full mailbox of a routee does not stop the timer.
+      return dest != target ||
+             !(target->reply || (target->state.load() & object_t::DELETING));
+    case post_result::enqueued:
+      break;
+    case post_result::runnable:
+      runnable.push_back(dest);
+      break;
+  }
+  return true;
+}
+
+void* runtime_t::allocate_frame(const size_t size) {
+  object_t* const active = thread_context.active_actor;
+  actor* const owner = active ? active->impl : nullptr;
+  frame_header_t* header = nullptr;
+
+  if (owner && owner->frame_cache_) {
+    frame_header_t* const cached =
+      static_cast<frame_header_t*>(owner->frame_cache_);
+
+    if (cached->size >= size) {
+      owner->frame_cache_ = nullptr;
+      header = cached;
+    }
+  }
+  if (!header) {
+    header = static_cast<frame_header_t*>(
+      ::operator new(sizeof(frame_header_t) + size));
+    header->size = size;
+  }
+  header->owner = owner;
+
+  return header + 1;
+}
+
+void runtime_t::deallocate_frame(void* const ptr) noexcept {
+  frame_header_t* header = static_cast<frame_header_t*>(ptr) - 1;
+
+  if (actor* const owner = header->owner) {
+    frame_header_t* const cached =
+      static_cast<frame_header_t*>(owner->frame_cache_);
+
+    if (!cached || cached->size < header->size) {
+      owner->frame_cache_ = header;
+      header = cached;
+    }
+  }
+
+  ::operator delete(header);
+}
+
+void runtime_t::delete_router(object_t* const obj) {
+  router_t* const router = obj->router;
+
+  for (object_t* const routee : router->routees) {
+    if (router->strategy == routing_strategy::smallest_mailbox) {
+      routee->observers.fetch_sub(1);
+    }
+    routee->runtime->release(routee);
+  }
+
+  delete router;
+}
+
+void runtime_t::delete_messages(msg_t* const first, msg_t* const last) {
+  for (msg_t* p = first;;) {
+    msg_t* const next = p->next;
+
+    delete p;
+
+    if (p == last) {
+      break;
+    }
+    p = next;
+  }
+}
+
+bool runtime_t::reserve_slot(object_t* const target,
+                             const bool try_only,
+                             const unsigned long count) {
+  const unsigned long capacity = target->capacity;
+  const unsigned long queued = target->queued.fetch_add(count);
+
+  if (queued + count <= capacity) {
+    return true;
+  }
+  if (!try_only) {
+    switch (target->overflow) {
+      case overflow_policy::reject:
+        break;
+      case overflow_policy::drop_oldest:
+        // The receiver discards the oldest messages when it selects
+        // the next one, unless it falls too far behind.
+        if (queued >= capacity * 2) {
+          target->evict_oldest();
+        }
+        return true;
+      case overflow_policy::block:
+        // Waiting on a worker thread or inside a handler may lead
+        // to a deadlock. A batch larger than the mailbox would never fit.
+        if (!thread_context.worker && !thread_context.active_actor &&
+            count <= capacity)
+        {
+          target->queued.fetch_sub(count);
+          return wait_slot(target, count);
+        }
+        break;
+    }
+  }
+
+  target->queued.fetch_sub(count);
+  return false;
+}
+
+bool runtime_t::wait_slot(object_t* const target, const unsigned long count) {
+  bool result = true;
+
+  target->blocked_senders.fetch_add(1);
+
+  while (target->queued.fetch_add(count) + count > target->capacity) {
+    target->queued.fetch_sub(count);
+
+    if (target->state.load() & object_t::DELETING) {
+      result = false;
+      break;
+    }
+
+    target->space_event.wait();
+  }
+
+  // Pass the wakeup to the next sender if some room is still available
+  // or the message will not be delivered anyway.
+  if (target->blocked_senders.fetch_sub(1) > 1 &&
+      (!result || target->queued.load() < target->capacity))
+  {
+    target->space_event.signaled();
+  }
+
+  return result;
+}
+
+void runtime_t::shutdown() {
+  // Do not let suspended handlers to delay the shutdown.
+  timers_.drain(true);
+  // Process all messages for binded actors and stop them.
+  thread_context.delete_actors(this);
+
+  // Process shared actors.
+  if (registry_.live.load()) {
+    std::vector<object_t*> actors;
+
+    actors.reserve(registry_.live.load());
+
+    for (uint32_t i = 0; i <= registry_.mask; ++i) {
+      auto& shard = registry_.shards[i];
+      std::lock_guard g(shard.mutex);
+      // Keep the objects alive while they are being deconstructed.
+      // An object is removed from the registry before it can be deleted,
+      // so it is safe to take a reference to it here even if there are
+      // no other references left.
+      for (object_t* obj = shard.head; obj; obj = obj->registry_next) {
+        obj->references++;
+        actors.push_back(obj);
+      }
+    }
+
+    for (auto ai = actors.cbegin(); ai != actors.cend(); ++ai) {
+      deconstruct_object(*ai);
+      release(*ai);
+    }
+
+    no_actors_event_.wait();
+  }
+
+  timers_.drain(false);
+
+  assert(registry_.live == 0);
+}
+
+object_t* runtime_t::make_instance(actor_ref context,
+                                   const actor_thread thread_opt,
+                                   const actor_priority priority,
+                                   std::unique_ptr<actor> body) {
+  assert(body);
+  // Create core object.
+  core::object_t* const result =
+    create_actor(std::move(body), thread_opt, priority);
+
+  if (result) {
+    active_actor_guard guard(result);
+
+    result->impl->context_ = std::move(context);
+    result->impl->self_ = actor_ref(result, true);
+    result->impl->bootstrap();
+  }
+
+  return result;
+}
+
+reply_t* runtime_t::ask(const actor_ref& target,
+                        std::unique_ptr<msg_t> msg,
+                        const uint32_t reply_type) {
+  runtime_t* const rt =
+    target.object_ ? target.object_->runtime : runtime_t::current();
+  reply_t* const reply = new reply_t(rt, reply_type);
+  object_t* const sender = &reply->object;
+  // The runtime should outlive all its objects.
+  rt->ref();
+
+  if (object_t* const obj = target.object_) {
+    obj->runtime->send_on_behalf(obj, sender, std::move(msg));
+  }
+  // The request holds the only reference to the sender from now on.
+  rt->release(sender);
+
+  return reply;
+}
+
+actor_ref runtime_t::make_router(const routing_strategy strategy,
+                                 std::vector<actor_ref> routees,
+                                 routing_keys keys) {
+  std::vector<object_t*> objects;
+
+  objects.reserve(routees.size());
+  // The router takes over the references to the routees.
+  for (actor_ref& ref : routees) {
+    if (object_t* const obj = std::exchange(ref.object_, nullptr)) {
+      if (strategy == routing_strategy::smallest_mailbox) {
+        obj->observers.fetch_add(1);
+      }
+      objects.push_back(obj);
+    }
+  }
+
+  object_t* const result = new object_t(
+    this, new router_t{strategy, std::move(objects), std::move(keys)});
+  // The runtime should outlive all its objects.
+  ref();
+
+  return actor_ref(result, false);
+}
+
+void runtime_t::make_instances(arena_t* const arena,
+                               const body_cast_t cast,
+                               std::vector<actor_ref>& result) {
+  object_t* first = nullptr;
+  object_t* last = nullptr;
+
+  // Link the objects in advance to register all of them at once.
+  for (size_t i = 0; i < arena->count; ++i) {
+    object_t* const obj =
+      new (arena->object(i)) object_t(this, cast(arena->body(i)), arena);
+
+    if (last) {
+      last->registry_next = obj;
+      obj->registry_prev = last;
+    } else {
+      first = obj;
+    }
+    last = obj;
+    // The runtime should outlive all its objects.
+    ref();
+  }
+
+  register_objects(first, last, arena->count);
+
+  for (size_t i = 0; i < arena->count; ++i) {
+    object_t* const obj = static_cast<object_t*>(arena->object(i));
+    active_actor_guard guard(obj);
+
+    obj->impl->self_ = actor_ref(obj, true);
+    result.push_back(actor_ref(obj, false));
+    obj->impl->bootstrap();
+  }
+}
+
+object_t* runtime_t::create_actor(std::unique_ptr<actor> body,
+                                  const actor_thread thread_opt,
+                                  const actor_priority priority) {
+  object_t* const result =
+    new core::object_t(this, thread_opt, priority, std::move(body));
+  // The runtime should outlive all its objects.
+  ref();
+  // Bind actor to the current thread if the thread did not created by the
+  // library.
+  if (thread_opt == actor_thread::bind && !thread_context.worker) {
+    result->references += 1;
+    thread_context.actors.push_back(result);
+  } else {
+    register_object(result);
+    // Create dedicated thread for the actor if necessary.
+    if (thread_opt == actor_thread::exclusive) {
+      worker_t* const worker = create_worker();
+
+      result->state.fetch_or(object_t::SCHEDULED);
+      result->thread = worker;
+
+      ++workers_.reserved;
+
+      worker->assign(result);
+    }
+  }
+
+  return result;
+}
+
+void runtime_t::register_object(object_t* const obj) {
+  register_objects(obj, obj, 1);
+}
+
+void runtime_t::register_objects(object_t* const first,
+                                 object_t* const last,
+                                 const size_t count) {
+  static std::atomic<uint32_t> counter{0};
+  // Threads are spread over the shards evenly.
+  static thread_local const uint32_t index = counter.fetch_add(1);
+
+  const uint32_t shard_index = index & registry_.mask;
+  auto& shard = registry_.shards[shard_index];
+
+  for (object_t* obj = first;; obj = obj->registry_next) {
+    obj->registry_shard = shard_index;
+    if (obj == last) {
+      break;
+    }
+  }
+
+  // The first objects make the runtime busy.
+  if (registry_.live.fetch_add(count) == 0) {
+    std::lock_guard<std::mutex> g(mutex_);
+    // Do not reset the event if the objects have already been unregistered.
+    if (registry_.live.load()) {
+      no_actors_event_.reset();
+    }
+  }
+
+  std::lock_guard g(shard.mutex);
+
+  last->registry_next = shard.head;
+  if (shard.head) {
+    shard.head->registry_prev = last;
+  }
+  shard.head = first;
+}
+
+void runtime_t::unregister_object(object_t* const obj) {
+  {
+    auto& shard = registry_.shards[obj->registry_shard];
+    std::lock_guard g(shard.mutex);
+
+    if (obj->registry_prev) {
+      obj->registry_prev->registry_next = obj->registry_next;
+    } else {
+      shard.head = obj->registry_next;
+    }
+    if (obj->registry_next) {
+      obj->registry_next->registry_prev = obj->registry_prev;
+    }
+    obj->registry_prev = obj->registry_next = nullptr;
+  }
+
+  // The last object makes the runtime idle.
+  if (registry_.live.fetch_sub(1) == 1) {
+    std::lock_guard<std::mutex> g(mutex_);
+    // Do not signal the event if a new object has been registered.
+    if (registry_.live.load() == 0) {
+      no_actors_event_.signaled();
+    }
+  }
+}
+
+worker_t* runtime_t::create_worker() {
+  run_queue_t* queue = nullptr;
+  // Allocate a slot for the worker's local queue.
+  // Workers without a slot share the global queue.
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+
+    if (!workers_.free_slots.empty()) {
+      queue = &workers_.queues[workers_.free_slots.back()];
+      workers_.free_slots.pop_back();
+    } else if (workers_.slots < config_.max_workers) {
+      queue = &workers_.queues[workers_.slots];
+      // Spread workers over the nodes evenly.
+      queue->node = workers_.slots % unsigned(topology_.size());
+      // Publish the slot for stealers.
+      workers_.slots.fetch_add(1, std::memory_order_release);
+    }
+  }
+
+  const std::vector<unsigned int>& cpus = topology_[queue ? queue->node : 0];
+
+  const worker_t::quantum_t quantum{
+    .time = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      config_.time_slice),
+    .messages = config_.slice_messages,
+    .check_interval = config_.slice_check_interval,
+    .preemptive = true};
+
+  worker_t* const result = new core::worker_t(
+    this, queue, quantum, config_.spin_before_park,
+    [this, &cpus](worker_t* worker) {
+      thread_context.worker = worker;
+      thread_context.runtime = this;
+      // Pin the thread to CPUs of its node.
+      if (!cpus.empty()) {
+        set_thread_affinity(cpus);
+      }
+    });
+
+  if (++workers_.count == 1) {
+    no_workers_event_.reset();
+  }
+
+  return result;
+}
+
+void runtime_t::delete_worker(worker_t* const worker) {
+  run_queue_t* const queue = worker->queue();
+
+  delete worker;
+  // An idle worker always has empty local queue, so the slot can be
+  // reused right away.
+  if (queue) {
+    std::lock_guard<std::mutex> g(mutex_);
+
+    workers_.free_slots.push_back(
+      static_cast<unsigned int>(queue - workers_.queues.get()));
+  }
+  // Уведомить, что удалены все вычислительные потоки
+  if (--workers_.count == 0) {
+    no_workers_event_.signaled();
+  }
+}
+
+void runtime_t::execute() {
+  auto last_cleanup_time = std::chrono::steady_clock::now();
+  auto new_worker_timeout = config_.grow_timeout;
+
+  while (active_) {
+    // Objects are placed into the global queue only if there were no idle
+    // workers at the moment, so the scheduler just have to provide enough
+    // workers to handle them.
+    while (!global_empty()) {
+      // Прежде чем извлекать объект из очереди, необходимо проверить,
+      // что есть вычислительные ресурсы для его обработки
+      worker_t* worker = pop_idle(0);
 
       if (!worker) {
         // Если текущее количество потоков меньше оптимального,
         // то создать новый поток
-        if (workers_.count < (workers_.reserved + m_processors)) {
+        if (workers_.count < target_workers()) {
           worker = create_worker();
         } else {
           // Подождать некоторое время осовобождения какого-нибудь потока
           const wait_result result =
             idle_workers_event_.wait(new_worker_timeout);
 
-          worker = workers_.idle.pop();
+          worker = pop_idle(0);
 
           if (!worker && (result == wait_result::timeout)) {
-            new_worker_timeout += std::chrono::seconds(2);
+            new_worker_timeout += config_.grow_timeout;
 
-            if (workers_.count < MAX_WORKERS) {
+            if (workers_.count < (workers_.reserved + workers_.blocked +
+                                  config_.max_workers))
+            {
               worker = create_worker();
             } else {
               idle_workers_event_.wait();
             }
-          } else if (new_worker_timeout > std::chrono::seconds(2)) {
-            new_worker_timeout -= std::chrono::seconds(2);
+          } else if (new_worker_timeout > config_.grow_timeout) {
+            new_worker_timeout -= config_.grow_timeout;
           }
         }
       }
 
       if (worker) {
-        if (object_t* const obj = queue_.pop()) {
-          worker->assign(obj, std::chrono::milliseconds(500));
+        if (object_t* const obj = pop_global(worker->node())) {
+          worker->assign(obj);
         } else {
-          workers_.idle.push(worker);
+          nodes_[worker->node()].idle.push(worker);
         }
       }
     }
 
-    if (terminating_ ||
-        (queue_event_.wait(std::chrono::seconds(60)) == wait_result::timeout))
-    {
-      auto idle_workers = workers_.idle.extract();
-      // Stop all idle threads.
-      while (worker_t* const item = idle_workers.pop_front()) {
+    // Number of workers allowed to be stopped.
+    const auto excess_workers = [this] {
+      const unsigned long kept = kept_workers();
+      return (workers_.count > kept) ? workers_.count - kept : 0;
+    };
+
+    // Stop compensating workers after blocking sections have been left.
+    while (workers_.retiring > 0) {
+      if (workers_.count <= std::max(target_workers(), kept_workers())) {
+        workers_.retiring = 0;
+      } else if (worker_t* const item = pop_idle(0)) {
         delete_worker(item);
+        --workers_.retiring;
+      } else {
+        // Will be retried when some worker becomes idle.
+        break;
+      }
+    }
+
+    if (terminating_) {
+      // Stop all idle threads.
+      for (size_t i = 0; i < topology_.size(); ++i) {
+        auto idle_workers = nodes_[i].idle.extract();
+
+        while (worker_t* const item = idle_workers.pop_front()) {
+          delete_worker(item);
+        }
+      }
+    } else if (queue_event_.wait(config_.idle_timeout) ==
+               wait_result::timeout)
+    {
+      // Stop all idle threads above the minimum.
+      for (auto n = excess_workers(); n > 0; --n) {
+        if (worker_t* const item = pop_idle(0)) {
+          delete_worker(item);
+        } else {
+          break;
+        }
       }
     } else if ((std::chrono::steady_clock::now() - last_cleanup_time) >
-               std::chrono::seconds(60))
+               config_.idle_timeout)
     {
-      if (worker_t* const item = workers_.idle.pop()) {
-        delete_worker(item);
+      if (excess_workers() > 0) {
+        if (worker_t* const item = pop_idle(0)) {
+          delete_worker(item);
+        }
       }
 
       last_cleanup_time = std::chrono::steady_clock::now();
@@ -452,16 +1743,268 @@ void runtime_t::push_delete(object_t* const obj) {
 void runtime_t::push_idle(worker_t* const worker) {
   assert(worker);
 
-  workers_.idle.push(worker);
+  nodes_[worker->node()].idle.push(worker);
   idle_workers_event_.signaled();
+  // Let the scheduler to stop the worker if it is not needed anymore.
+  if (workers_.retiring > 0) {
+    queue_event_.signaled();
+  }
+}
+
+unsigned long runtime_t::target_workers() const noexcept {
+  return workers_.reserved + workers_.blocked + m_processors;
+}
+
+unsigned long runtime_t::kept_workers() const noexcept {
+  return workers_.reserved + workers_.blocked + config_.min_workers;
+}
+
+bool runtime_t::global_empty() const {
+  for (size_t i = 0; i < topology_.size(); ++i) {
+    if (!nodes_[i].queue.empty()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+object_t* runtime_t::pop_global(const unsigned int node) {
+  const unsigned int count = unsigned(topology_.size());
+
+  for (unsigned int i = 0; i < count; ++i) {
+    if (object_t* const obj = nodes_[(node + i) % count].queue.pop()) {
+      return obj;
+    }
+  }
+  return nullptr;
+}
+
+worker_t* runtime_t::pop_idle(const unsigned int node) {
+  const unsigned int count = unsigned(topology_.size());
+
+  for (unsigned int i = 0; i < count; ++i) {
+    if (worker_t* const worker = nodes_[(node + i) % count].idle.pop()) {
+      return worker;
+    }
+  }
+  return nullptr;
+}
+
+object_t* runtime_t::steal_object(const run_queue_t* const self,
+                                  const unsigned int node,
+                                  const bool same_node) {
+  const unsigned int count = workers_.slots.load(std::memory_order_acquire);
+
+  if (count == 0) {
+    return nullptr;
+  }
+  // Start from a random victim to spread contention between the queues.
+  const unsigned int start = next_random() % count;
+
+  for (unsigned int i = 0; i < count; ++i) {
+    run_queue_t* const victim = &workers_.queues[(start + i) % count];
+
+    if (victim == self || (victim->node == node) != same_node) {
+      continue;
+    }
+    if (object_t* const obj = victim->pop()) {
+      return obj;
+    }
+    if (victim->next.load(std::memory_order_relaxed)) {
+      if (object_t* const obj = victim->next.exchange(nullptr)) {
+        return obj;
+      }
+    }
+  }
+
+  return nullptr;
 }
 
 object_t* runtime_t::pop_object() {
-  return queue_.pop();
+  assert(thread_context.worker && thread_context.runtime == this);
+
+  run_queue_t* const local = thread_context.worker->queue();
+  const unsigned int node = thread_context.worker->node();
+
+  if (object_t* const obj = pop_next(local, node)) {
+    return obj;
+  }
+
+  // Objects of a higher priority in the global queue go ahead of
+  // the local ones.
+  if (local && (++thread_context.pops % GLOBAL_QUEUE_INTERVAL) != 0 &&
+      local->top() >= nodes_[node].queue.top())
+  {
+    if (object_t* const obj = local->pop()) {
+      return obj;
+    }
+  }
+  if (object_t* const obj = nodes_[node].queue.pop()) {
+    return obj;
+  }
+  if (local) {
+    if (object_t* const obj = local->pop()) {
+      return obj;
+    }
+  }
+  if (object_t* const obj = steal_object(local, node, true)) {
+    return obj;
+  }
+  // Go to other nodes only if there is no work on the current one.
+  if (topology_.size() > 1) {
+    if (object_t* const obj = pop_global(node)) {
+      return obj;
+    }
+    return steal_object(local, node, false);
+  }
+
+  return nullptr;
+}
+
+bool runtime_t::should_yield(const object_t* const obj) {
+  assert(thread_context.worker && thread_context.runtime == this);
+
+  const int priority = int(obj->priority);
+
+  if (priority == object_queue_t::LEVELS - 1) {
+    return false;
+  }
+  if (nodes_[thread_context.worker->node()].queue.top() > priority) {
+    return true;
+  }
+  if (run_queue_t* const local = thread_context.worker->queue()) {
+    return local->top() > priority;
+  }
+  return false;
+}
+
+object_t* runtime_t::pop_next(run_queue_t* const local,
+                              const unsigned int node) {
+  const unsigned int chain = thread_context.chain;
+
+  thread_context.chain = 0;
+
+  if (!local || !local->next.load(std::memory_order_relaxed)) {
+    return nullptr;
+  }
+
+  object_t* const obj = local->next.exchange(nullptr);
+
+  if (!obj) {
+    return nullptr;
+  }
+  // Objects of a higher priority and the ones which have been waiting
+  // in the queue for a while go first.
+  const int priority = int(obj->priority);
+
+  if (chain < config_.next_slot_limit && local->top() <= priority &&
+      nodes_[node].queue.top() <= priority)
+  {
+    thread_context.chain = chain + 1;
+    return obj;
+  }
+
+  local->push(obj);
+  return nullptr;
 }
 
 void runtime_t::push_object(object_t* const obj) {
-  if (queue_.push(obj)) {
+  worker_t* const worker =
+    (thread_context.runtime == this) ? thread_context.worker : nullptr;
+  object_t* const active = thread_context.active_actor;
+  // The object woken by a handler will be run next by the same worker,
+  // the previous occupant of the slot is scheduled as usual.
+  if (worker && worker->queue() && config_.next_slot_limit &&
+      !thread_context.blocking && active && active != obj &&
+      !active->exclusive)
+  {
+    if (object_t* const prev = worker->queue()->next.exchange(obj)) {
+      schedule_object(prev, worker, active);
+    }
+    return;
+  }
+
+  schedule_object(obj, worker, active);
+}
+
+void runtime_t::schedule_object(object_t* const obj,
+                                worker_t* const worker,
+                                object_t* const active) {
+  const unsigned int node =
+    obj->node.load(std::memory_order_relaxed) % unsigned(topology_.size());
+  // Hand the object straight to an idle worker,
+  // preferring the node the object was last run on.
+  if (worker_t* const idle = pop_idle(node)) {
+    idle->assign(obj);
+    return;
+  }
+  // Objects scheduled by a worker thread are placed into its local queue
+  // and will be processed by the worker itself, unless the worker is
+  // dedicated to an exclusive actor or is blocked.
+  if (worker && worker->queue() && !thread_context.blocking &&
+      !(active && active->exclusive))
+  {
+    worker->queue()->push(obj);
+    share_local(worker, node);
+  } else if (nodes_[node].queue.push(obj)) {
+    // Let the scheduler to allocate a new worker.
+    queue_event_.signaled();
+  }
+}
+
+void runtime_t::share_local(worker_t* const worker, const unsigned int node) {
+  // A worker might have gone idle after the idle list was checked last
+  // time, so no one would take the object until the current worker
+  // finishes its time slice. The list is checked without the lock, so
+  // a worker parking at this very moment can still be missed. Then the
+  // object waits for the current worker or for a busy one to steal it,
+  // which is bounded by time_slice.
+  if (nodes_[node].idle.empty()) {
+    return;
+  }
+  if (worker_t* const idle = pop_idle(node)) {
+    if (object_t* const obj = worker->queue()->pop()) {
+      idle->assign(obj);
+    } else {
+      push_idle(idle);
+    }
+  }
+}
+
+void runtime_t::schedule_batch(object_t* const* const objects,
+                               const size_t count) {
+  worker_t* const worker =
+    (thread_context.runtime == this) ? thread_context.worker : nullptr;
+  object_t* const active = thread_context.active_actor;
+  const bool local = worker && worker->queue() && !thread_context.blocking &&
+                     !(active && active->exclusive);
+  size_t i = 0;
+  bool wakeup = false;
+  // Hand objects to idle workers while there are any.
+  for (; i < count; ++i) {
+    const unsigned int node = objects[i]->node.load(std::memory_order_relaxed) %
+                              unsigned(topology_.size());
+
+    if (worker_t* const idle = pop_idle(node)) {
+      idle->assign(objects[i]);
+    } else {
+      break;
+    }
+  }
+  // Queue the rest and let the scheduler know about them only once.
+  for (; i < count; ++i) {
+    if (local) {
+      worker->queue()->push(objects[i]);
+      share_local(worker, worker->node());
+    } else {
+      const unsigned int node =
+        objects[i]->node.load(std::memory_order_relaxed) %
+        unsigned(topology_.size());
+
+      wakeup |= nodes_[node].queue.push(objects[i]);
+    }
+  }
+  if (wakeup) {
     queue_event_.signaled();
   }
 }
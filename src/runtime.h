@@ -1,30 +1,70 @@
 #pragma once
 
 #include "acto/acto.h"
+#include "timer.h"
+#include "topology.h"
 #include "worker.h"
 
 #include <atomic>
+#include <bit>
 #include <memory>
 #include <thread>
-#include <unordered_set>
+#include <vector>
 
 namespace acto::core {
 
+/**
+ * Routing table of a router.
+ */
+struct router_t {
+  const routing_strategy strategy;
+  /// Routees the router holds references to.
+  const std::vector<object_t*> routees;
+  /// Functions computing keys of messages for consistent hashing.
+  const routing_keys keys;
+  /// Number of messages routed in turn.
+  alignas(64) std::atomic<uint64_t> next{0};
+};
+
 /**
  * Данные среды выполнения
  */
 class runtime_t : public worker_t::callbacks {
-  using actors_set = std::unordered_set<object_t*>;
-
-  // Максимальное кол-во рабочих потоков в системе
-  static constexpr unsigned int MAX_WORKERS = 512;
+  friend class timer_wheel_t;
 
 public:
-  runtime_t();
+  runtime_t(const runtime_config& config);
   ~runtime_t();
 
+  /// Default runtime instance.
   static runtime_t* instance();
 
+  /// Runtime of the active actor or of the current worker thread.
+  /// Default instance otherwise.
+  static runtime_t* current();
+
+  /// Sets config for the runtime instance.
+  /// @return false if the instance has already been created.
+  static bool configure(const runtime_config& config);
+
+  /// Excludes the current worker from the shared pool until
+  /// leave_blocking() is called.
+  /// @return runtime of the worker or nullptr if the current thread is
+  ///         not a worker of the shared pool.
+  static runtime_t* enter_blocking();
+
+  /// Acquires reference to the sender of a message.
+  /// Worker threads take the reference from a thread local cache of
+  /// references acquired in advance.
+  static void acquire_sender(object_t* const obj) noexcept;
+
+  /// Releases reference to the object.
+  /// Worker threads defer the release until flush_references() is called.
+  static void release_deferred(object_t* const obj);
+
+  /// Releases all references deferred by the current thread.
+  static void flush_references();
+
 public:
   /// Aquires reference to the object.
   unsigned long acquire(object_t* const obj) const noexcept;
@@ -39,36 +79,264 @@ public:
   /// Ждать уничтожения тела объекта
   void join(object_t* const obj);
 
-  /// -
-  bool process_binded_actors();
+  /// Gives the actors bound to the current thread turns to handle
+  /// their messages within the budget, or a single round if there is
+  /// no budget.
+  static bool process_binded_actors(
+    const this_thread::process_budget* const budget);
 
-  /// -
-  unsigned long release(object_t* const obj);
+  /// Releases count references to the object and deconstructs it if
+  /// there are no more references.
+  unsigned long release(object_t* const obj, const unsigned long count = 1);
 
   /// Sends the message to the specific actor.
   /// Uses the active actor as a sender.
   bool send(object_t* const target, std::unique_ptr<msg_t> msg);
 
+  /// Sends the message to the specific actor if there is room in
+  /// its mailbox.
+  /// Uses the active actor as a sender.
+  bool try_send(object_t* const target, std::unique_ptr<msg_t> msg);
+
   /// Sends the message to the specific actor.
+  /// Never waits or discards other messages if try_only is set.
   bool send_on_behalf(object_t* const target,
                       object_t* sender,
-                      std::unique_ptr<msg_t> msg);
+                      std::unique_ptr<msg_t> msg,
+                      const bool try_only = false);
+
+  /// Sends the linked chain of messages to the specific actor at once.
+  /// Uses the active actor as a sender.
+  bool send_batch(object_t* const target,
+                  msg_t* const first,
+                  msg_t* const last,
+                  const unsigned long count);
+
+  /// Sends the shared payload to all targets.
+  /// Uses the active actor as a sender.
+  static size_t multicast(std::span<const actor_ref> targets,
+                          shared_payload_t* const payload,
+                          const uint32_t type);
 
   /// Cleanups allocated resources.
   void shutdown();
 
+  /// Stops all worker threads.
+  /// The runtime cannot process messages after the call.
+  void stop();
+
+  /// Acquires reference to the runtime.
+  void ref() noexcept;
+
+  /// Releases reference to the runtime and deletes it if
+  /// there are no more references.
+  void unref() noexcept;
+
+  /// Returns the current worker to the shared pool.
+  void leave_blocking();
+
   object_t* make_instance(actor_ref context,
                           const actor_thread thread_opt,
+                          const actor_priority priority,
                           std::unique_ptr<actor> body);
 
+  /// Sends the request on behalf of a new reply slot.
+  static reply_t* ask(const actor_ref& target,
+                      std::unique_ptr<msg_t> msg,
+                      const uint32_t reply_type);
+
+  /// Creates a router spreading messages over the routees.
+  actor_ref make_router(const routing_strategy strategy,
+                        std::vector<actor_ref> routees,
+                        routing_keys keys);
+
+  /// Creates objects of the shared pool for all bodies of the arena.
+  void make_instances(arena_t* const arena,
+                      const body_cast_t cast,
+                      std::vector<actor_ref>& result);
+
+  /// Allocates a frame of a coroutine.
+  /// The frame is taken from the cache of the active actor if it fits.
+  static void* allocate_frame(const size_t size);
+
+  /// Keeps the frame in the cache of the actor it was allocated for
+  /// unless there is a larger one.
+  static void deallocate_frame(void* const ptr) noexcept;
+
+  /// Suspends the coroutine handler of the active actor until the request
+  /// is completed.
+  static bool await_reply(reply_t* const reply,
+                          const std::coroutine_handle<> h);
+
+  /// Suspends the coroutine handler of the active actor until
+  /// the deadline.
+  static bool await_delay(const std::chrono::steady_clock::time_point deadline,
+                          const std::coroutine_handle<> h);
+
+  /// Lets the suspended handler of the object to be resumed and releases
+  /// the reference taken on suspension.
+  static void resume_object(object_t* const obj);
+
+  /// Sends the message to the target after the delay.
+  /// @return null if the target is empty.
+  static timer_entry_t* send_after(const actor_ref& target,
+                                   const std::chrono::nanoseconds delay,
+                                   std::unique_ptr<msg_t> msg);
+
+  /// Sends the shared payload to the target every period.
+  /// @return null if the target is empty.
+  static timer_entry_t* send_every(const actor_ref& target,
+                                   const std::chrono::nanoseconds period,
+                                   shared_payload_t* const payload,
+                                   const uint32_t type);
+
 private:
   object_t* create_actor(std::unique_ptr<actor> body,
-                         const actor_thread thread_opt);
+                         const actor_thread thread_opt,
+                         const actor_priority priority);
 
   worker_t* create_worker();
 
+  /// Lets the dedicated thread retry the deconstruction of the object
+  /// postponed because of the senders.
+  void wakeup_thread(object_t* const obj);
+
+  /// Result of placing messages into a mailbox.
+  enum class post_result {
+    /// The messages have not been placed into the mailbox.
+    rejected,
+    /// The messages have been placed into the mailbox.
+    enqueued,
+    /// The messages have been placed into the mailbox and the target
+    /// should be scheduled by the caller.
+    runnable,
+  };
+
+  /// Places the linked chain of messages into the mailbox.
+  post_result post_messages(object_t* const target,
+                            object_t* const sender,
+                            msg_t* const first,
+                            msg_t* const last,
+                            const unsigned long count,
+                            const bool try_only);
+
+  /// Places the linked chain of messages into the mailbox and schedules
+  /// the target if necessary.
+  bool enqueue_messages(object_t* const target,
+                        object_t* const sender,
+                        msg_t* const first,
+                        msg_t* const last,
+                        const unsigned long count,
+                        const bool try_only);
+
+  /// Selects a routee for the message.
+  /// @return null if the router has been destroyed or has no routees.
+  static object_t* route(object_t* const target, const msg_t* const msg);
+
+  /// Stores the reply into the slot of the request.
+  static bool complete_reply(object_t* const target,
+                             msg_t* const first,
+                             msg_t* const last,
+                             const unsigned long count);
+
+  /// Releases the routees and deletes the routing table.
+  void delete_router(object_t* const obj);
+
+  /// Records the coroutine as the suspended handler of the active actor
+  /// and takes a reference to it.
+  /// @return null if there is no active actor.
+  static object_t* suspend_active(const std::coroutine_handle<> h);
+
+  /// Resets the suspended handler if the awaited operation has completed
+  /// before the handler was suspended.
+  static void cancel_suspension(object_t* const obj);
+
+  /// Marks the suspended handler of the object as resumable.
+  /// @return true if the object should be scheduled by the caller.
+  static bool make_resumable(object_t* const obj);
+
+  /// Delivers messages of expired timers and resumes handlers whose
+  /// delays have passed. All objects woken are scheduled at once.
+  /// Only periodic timers to be rearmed are left in the list.
+  void fire_timers(std::vector<timer_entry_t*>& entries);
+
+  /// Places the message of a timer into the mailbox of the target.
+  /// @return false if the target will not accept messages any more.
+  static bool post_timer(object_t* const target,
+                         msg_t* const msg,
+                         std::vector<object_t*>& runnable);
+
+  /// Schedules the woken objects grouped by runtimes.
+  static void schedule_runnable(const std::vector<object_t*>& runnable);
+
+  /// Deletes the linked chain of messages.
+  static void delete_messages(msg_t* const first, msg_t* const last);
+
+  /// Reserves room for count messages in a bounded mailbox according to
+  /// its overflow policy.
+  bool reserve_slot(object_t* const target,
+                    const bool try_only,
+                    const unsigned long count);
+
+  /// Waits until there is room for count messages in the mailbox.
+  /// @return false if the target is being deleted.
+  bool wait_slot(object_t* const target, const unsigned long count);
+
+  void delete_worker(worker_t* const worker);
+
   void execute();
 
+  /// Number of workers in the shared pool the scheduler aims at
+  /// including dedicated and blocked ones.
+  unsigned long target_workers() const noexcept;
+
+  /// Number of workers which are never stopped by the shrink policy.
+  unsigned long kept_workers() const noexcept;
+
+  /// Tries to steal a runnable object from a random worker's local queue.
+  /// Only workers of the given node or of other nodes are considered
+  /// depending on same_node flag.
+  object_t* steal_object(const run_queue_t* const self,
+                         const unsigned int node,
+                         const bool same_node);
+
+  /// Retrieves an object from the global queues starting from the node.
+  object_t* pop_global(const unsigned int node);
+
+  /// Retrieves the object from the worker's next slot unless the limit of
+  /// runs in a row has been reached or more urgent objects are waiting.
+  object_t* pop_next(run_queue_t* const local, const unsigned int node);
+
+  /// Places the object into a run queue or hands it to an idle worker.
+  void schedule_object(object_t* const obj,
+                       worker_t* const worker,
+                       object_t* const active);
+
+  /// Hands an object from the local queue of the worker to a worker which
+  /// has become idle since the queue was pushed to.
+  void share_local(worker_t* const worker, const unsigned int node);
+
+  /// Adds the object to the registry.
+  void register_object(object_t* const obj);
+
+  /// Adds the chain of objects linked with registry links to the registry
+  /// within a single critical section.
+  void register_objects(object_t* const first,
+                        object_t* const last,
+                        const size_t count);
+
+  /// Removes the object from the registry.
+  void unregister_object(object_t* const obj);
+
+  /// Schedules the objects woken at once.
+  void schedule_batch(object_t* const* const objects, const size_t count);
+
+  /// Whether all global queues are empty.
+  bool global_empty() const;
+
+  /// Retrieves an idle worker preferring the given node.
+  worker_t* pop_idle(const unsigned int node);
+
 private:
   void push_delete(object_t* const obj) override;
 
@@ -78,18 +346,65 @@ private:
 
   void push_object(object_t* const obj) override;
 
+  bool should_yield(const object_t* const obj) override;
+
 private:
+  /// Resources of a NUMA node.
+  struct node_t {
+    /// Global queue of objects with non empty inbox last run on the node.
+    /// Receives objects scheduled outside of worker threads.
+    object_queue_t queue;
+    /// List of idle threads.
+    /// Senders take workers from the list to hand them runnable objects.
+    intrusive::locked_stack<worker_t> idle;
+  };
+
   struct workers_t {
+    workers_t(const unsigned int max_workers)
+      : queues(new run_queue_t[max_workers]) {
+    }
+
     /// Number of allocated threads.
     std::atomic<unsigned long> count{0};
     /// Number of dedicated threads.
     std::atomic<unsigned long> reserved{0};
-    /// List of idle threads.
-    intrusive::mpsc_stack<worker_t> idle;
+    /// Number of workers inside blocking sections.
+    std::atomic<unsigned long> blocked{0};
+    /// Number of compensating workers to be stopped.
+    std::atomic<unsigned long> retiring{0};
+    /// Local run queues of the workers indexed by a slot number.
+    std::unique_ptr<run_queue_t[]> queues;
+    /// Number of slots have ever been used.
+    std::atomic<unsigned int> slots{0};
+    /// Slots released by deleted workers.
+    std::vector<unsigned int> free_slots;
+  };
+
+  /// Registry of objects managed by the runtime.
+  /// Objects are linked into intrusive lists of shards, so threads spawning
+  /// and deleting objects rarely contend for the same lock.
+  struct registry_t {
+    struct alignas(64) shard_t {
+      intrusive::spin_lock mutex;
+      object_t* head{nullptr};
+    };
+
+    registry_t(const unsigned int count)
+      : shards(new shard_t[count])
+      , mask(count - 1) {
+    }
+
+    std::unique_ptr<shard_t[]> shards;
+    /// Number of shards minus one.
+    const uint32_t mask;
+    /// Number of registered objects.
+    std::atomic<unsigned long> live{0};
   };
 
-  /// Number of physical cores in the system.
-  const unsigned long m_processors{std::thread::hardware_concurrency()};
+  /// Parameters of the runtime.
+  const runtime_config config_;
+  /// Number of workers in the shared pool the scheduler aims at.
+  const unsigned long m_processors;
 
   std::mutex mutex_;
   /// There are no more managed objects event.
@@ -101,16 +416,25 @@ private:
   /// There are no more worker threads event.
   event no_workers_event_;
 
-  /// Set of managed objects.
-  actors_set actors_;
-  /// Queue of objects with non empty inbox.
-  intrusive::queue<object_t> queue_;
+  /// CPUs of NUMA nodes the workers are grouped by.
+  /// There is a single node if the runtime is not NUMA aware.
+  const std::vector<std::vector<unsigned int>> topology_;
+  /// Queues of the nodes.
+  std::unique_ptr<node_t[]> nodes_;
   /// Currently allocated worker threads.
-  workers_t workers_;
+  workers_t workers_{config_.max_workers};
+  /// Managed objects.
+  registry_t registry_{std::bit_ceil(config_.max_workers)};
+  /// Count of references to the runtime.
+  /// Each object holds a reference to its runtime.
+  std::atomic<unsigned long> references_{1};
   /// -
   std::atomic<bool> active_{true};
   std::atomic<bool> terminating_{false};
+  /// Delayed and periodic messages and handlers suspended for some time.
+  timer_wheel_t timers_{this, config_.timer_tick};
   /// Scheduler thread.
+  /// Maintains size of the pool and serves objects from the global queue.
   std::thread m_scheduler;
 };
 
@@ -0,0 +1,380 @@
+#include "timer.h"
+#include "runtime.h"
+
+#include <algorithm>
+
+namespace acto::core {
+
+timer_wheel_t::timer_wheel_t(runtime_t* const owner,
+                             const clock::duration tick)
+  : runtime_(owner)
+  , tick_(tick)
+  , origin_(clock::now()) {
+}
+
+timer_wheel_t::~timer_wheel_t() {
+  stop();
+}
+
+void timer_wheel_t::add(timer_entry_t* const entry,
+                        const clock::time_point deadline,
+                        const clock::duration period) {
+  const uint64_t due = ticks(deadline);
+
+  entry->deadline = due;
+  // A period shorter than the tick is rounded up to the tick.
+  if (period > clock::duration::zero()) {
+    entry->period = std::max<uint64_t>(
+      1, uint64_t((period + tick_ - clock::duration(1)) / tick_));
+  }
+
+  bool accepted = false;
+
+  {
+    std::lock_guard g(mutex_);
+    // The flag is checked along with the push, so all entries added
+    // before the stop are taken over by it.
+    if (!stopping_.load()) {
+      start();
+      added_.push(entry);
+      accepted = true;
+    }
+  }
+
+  if (!accepted) {
+    if (entry->resumes()) {
+      runtime_t::resume_object(entry->target);
+      delete entry;
+    } else {
+      release_resources(entry);
+      release(entry);
+    }
+    return;
+  }
+  // Wake the thread if it sleeps past the deadline.
+  if (due < wake_tick_.load()) {
+    wakeup_.signaled();
+  }
+}
+
+bool timer_wheel_t::add_resume(object_t* const obj,
+                               const clock::time_point deadline) {
+  if (draining_.load()) {
+    return false;
+  }
+
+  add(new timer_entry_t(obj, 1), deadline, clock::duration::zero());
+  return true;
+}
+
+void timer_wheel_t::drain(const bool value) {
+  draining_.store(value);
+  if (value && started_.load()) {
+    drain_requested_.store(true);
+    wakeup_.signaled();
+  }
+}
+
+void timer_wheel_t::stop() {
+  {
+    std::lock_guard g(mutex_);
+
+    stopping_.store(true);
+  }
+  wakeup_.signaled();
+
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+
+  // Drop all pending entries.
+  std::vector<timer_entry_t*> entries;
+
+  take_added();
+  for (auto& level : slots_) {
+    for (slot_t& slot : level) {
+      for (timer_entry_t* entry = slot.head; entry;) {
+        timer_entry_t* const next = entry->next;
+
+        entries.push_back(entry);
+        entry = next;
+      }
+      slot = slot_t();
+    }
+  }
+  count_ = 0;
+
+  for (timer_entry_t* const entry : entries) {
+    if (entry->resumes()) {
+      runtime_t::resume_object(entry->target);
+      delete entry;
+      continue;
+    }
+
+    uint32_t pending = timer_entry_t::PENDING;
+
+    if (entry->state.compare_exchange_strong(pending, timer_entry_t::DONE)) {
+      release_resources(entry);
+    }
+    release(entry);
+  }
+}
+
+bool timer_wheel_t::cancel(timer_entry_t* const entry) {
+  uint32_t state = entry->state.load();
+
+  while (state == timer_entry_t::PENDING || state == timer_entry_t::FIRING) {
+    if (entry->state.compare_exchange_weak(state, timer_entry_t::CANCELLED)) {
+      // Resources of a firing timer are released by the thread
+      // of the wheel.
+      if (state == timer_entry_t::PENDING) {
+        release_resources(entry);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+void timer_wheel_t::release(timer_entry_t* const entry) noexcept {
+  if (entry->references.fetch_sub(1) == 1) {
+    delete entry;
+  }
+}
+
+void timer_wheel_t::release_resources(timer_entry_t* const entry) {
+  delete std::exchange(entry->msg, nullptr);
+
+  if (shared_payload_t* const payload = std::exchange(entry->payload, nullptr))
+  {
+    if (payload->references.fetch_sub(1) == 1) {
+      delete payload;
+    }
+  }
+
+  entry->target->runtime->release(entry->target);
+}
+
+uint64_t timer_wheel_t::ticks(const clock::time_point time) const noexcept {
+  if (time <= origin_) {
+    return 0;
+  }
+  // Round up, so messages are never delivered early.
+  return uint64_t((time - origin_ + tick_ - clock::duration(1)) / tick_);
+}
+
+void timer_wheel_t::start() {
+  if (!started_.load()) {
+    thread_ = std::thread(&timer_wheel_t::execute, this);
+    started_.store(true, std::memory_order_release);
+  }
+}
+
+void timer_wheel_t::execute() {
+  std::vector<timer_entry_t*> expired;
+
+  current_ = ticks(clock::now());
+
+  while (!stopping_.load()) {
+    take_added();
+
+    if (drain_requested_.exchange(false)) {
+      take_resumes(expired);
+    }
+    // Time elapsed since the previous turn is passed tick by tick,
+    // unless there is nothing to expire.
+    const uint64_t now = (clock::now() - origin_) / tick_;
+
+    if (count_ == 0) {
+      current_ = std::max(current_, now + 1);
+    }
+    while (current_ <= now) {
+      advance(expired);
+    }
+
+    if (!expired.empty()) {
+      runtime_->fire_timers(expired);
+      // Rearm periodic timers.
+      for (timer_entry_t* const entry : expired) {
+        entry->deadline = std::max(entry->deadline + entry->period, current_);
+        insert(entry);
+      }
+      expired.clear();
+      continue;
+    }
+
+    const uint64_t next = next_tick();
+
+    wake_tick_.exchange(next);
+    // An entry might have been added before the wake tick was set.
+    if (added_.empty() && !stopping_.load() && !drain_requested_.load()) {
+      if (next == UINT64_MAX) {
+        wakeup_.wait();
+      } else {
+        const auto timeout = origin_ + next * tick_ - clock::now();
+
+        if (timeout > clock::duration::zero()) {
+          wakeup_.wait(timeout);
+        }
+      }
+    }
+    wake_tick_.store(0);
+  }
+}
+
+void timer_wheel_t::take_added() {
+  auto added = added_.extract();
+  timer_entry_t* first = nullptr;
+  // Restore the order of addition.
+  while (timer_entry_t* const entry = added.pop_front()) {
+    entry->next = first;
+    first = entry;
+  }
+  while (timer_entry_t* const entry = first) {
+    first = entry->next;
+
+    if (entry->state.load() == timer_entry_t::CANCELLED) {
+      release(entry);
+    } else {
+      insert(entry);
+    }
+  }
+}
+
+void timer_wheel_t::insert(timer_entry_t* const entry) noexcept {
+  // Overdue entries are expired on the current tick.
+  uint64_t due = std::max(entry->deadline, current_);
+  uint64_t delta = due - current_;
+
+  if (delta > MAX_DELTA) {
+    // The entry will be moved closer as the wheel turns.
+    delta = MAX_DELTA;
+    due = current_ + delta;
+  }
+
+  unsigned int level = 0;
+
+  while (delta >> (SLOT_BITS * (level + 1))) {
+    ++level;
+  }
+
+  slot_t& slot = slots_[level][(due >> (SLOT_BITS * level)) & MASK];
+
+  entry->next = nullptr;
+  if (slot.tail) {
+    slot.tail->next = entry;
+  } else {
+    slot.head = entry;
+  }
+  slot.tail = entry;
+  ++count_;
+}
+
+void timer_wheel_t::advance(std::vector<timer_entry_t*>& expired) {
+  const uint64_t index = current_ & MASK;
+  // Move entries of upper levels down when the level below wraps around.
+  if (index == 0) {
+    for (unsigned int level = 1; level < LEVELS; ++level) {
+      const uint64_t upper = (current_ >> (SLOT_BITS * level)) & MASK;
+
+      cascade(level, upper);
+      if (upper != 0) {
+        break;
+      }
+    }
+  }
+
+  slot_t& slot = slots_[0][index];
+  timer_entry_t* entry = std::exchange(slot.head, nullptr);
+
+  slot.tail = nullptr;
+
+  while (entry) {
+    timer_entry_t* const next = entry->next;
+
+    --count_;
+    // The deadline of the entry was beyond the range of the wheel.
+    if (entry->deadline > current_) {
+      insert(entry);
+    } else {
+      expire(entry, expired);
+    }
+    entry = next;
+  }
+
+  ++current_;
+}
+
+void timer_wheel_t::cascade(const unsigned int level, const uint64_t index) {
+  slot_t& slot = slots_[level][index];
+  timer_entry_t* entry = std::exchange(slot.head, nullptr);
+
+  slot.tail = nullptr;
+
+  while (entry) {
+    timer_entry_t* const next = entry->next;
+
+    --count_;
+    if (entry->state.load() == timer_entry_t::CANCELLED) {
+      release(entry);
+    } else {
+      insert(entry);
+    }
+    entry = next;
+  }
+}
+
+void timer_wheel_t::take_resumes(std::vector<timer_entry_t*>& expired) {
+  for (auto& level : slots_) {
+    for (slot_t& slot : level) {
+      timer_entry_t* entry = std::exchange(slot.head, nullptr);
+
+      slot.tail = nullptr;
+      // Keep other entries in the slot in the same order.
+      while (entry) {
+        timer_entry_t* const next = entry->next;
+
+        if (entry->resumes()) {
+          --count_;
+          expired.push_back(entry);
+        } else {
+          entry->next = nullptr;
+          if (slot.tail) {
+            slot.tail->next = entry;
+          } else {
+            slot.head = entry;
+          }
+          slot.tail = entry;
+        }
+        entry = next;
+      }
+    }
+  }
+}
+
+uint64_t timer_wheel_t::next_tick() const noexcept {
+  if (count_ == 0) {
+    return UINT64_MAX;
+  }
+  // Look for a non empty slot up to the end of the current revolution
+  // of the lowest level, where upper levels are cascaded.
+  for (uint64_t tick = current_;; ++tick) {
+    if ((tick & MASK) == 0 || slots_[0][tick & MASK].head) {
+      return tick;
+    }
+    if (((tick + 1) & MASK) == 0) {
+      return tick + 1;
+    }
+  }
+}
+
+void timer_wheel_t::expire(timer_entry_t* const entry,
+                           std::vector<timer_entry_t*>& expired) noexcept {
+  if (entry->state.load() == timer_entry_t::CANCELLED) {
+    release(entry);
+  } else {
+    expired.push_back(entry);
+  }
+}
+
+} // namespace acto::core
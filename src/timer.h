@@ -0,0 +1,176 @@
+#pragma once
+
+#include "acto/acto.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace acto::core {
+
+class runtime_t;
+
+/**
+ * Message or suspended handler scheduled for a point of time.
+ */
+struct timer_entry_t : intrusive::node<timer_entry_t> {
+  /// The entry waits for its deadline.
+  static constexpr uint32_t PENDING = 0;
+  /// The message of a periodic timer is being sent.
+  static constexpr uint32_t FIRING = 1;
+  /// The message has been sent or the target is gone.
+  static constexpr uint32_t DONE = 2;
+  /// The timer has been cancelled.
+  static constexpr uint32_t CANCELLED = 3;
+
+  /// Receiver of the message or the object of the suspended handler.
+  /// The entry holds a reference to the object.
+  object_t* const target;
+  /// Message of a one-shot timer.
+  msg_t* msg{nullptr};
+  /// Payload of a periodic timer.
+  shared_payload_t* payload{nullptr};
+  /// Type of the payload.
+  uint32_t type{0};
+  /// Deadline in ticks of the wheel.
+  uint64_t deadline{0};
+  /// Period in ticks. Zero for one-shot timers.
+  uint64_t period{0};
+  std::atomic<uint32_t> state{PENDING};
+  /// The handle and the wheel.
+  std::atomic<uint32_t> references;
+
+  timer_entry_t(object_t* const obj, const uint32_t refs) noexcept
+    : target(obj)
+    , references(refs) {
+  }
+
+  /// The entry resumes a suspended handler instead of sending a message.
+  bool resumes() const noexcept {
+    return !msg && !payload;
+  }
+};
+
+/**
+ * Hierarchical timing wheel.
+ *
+ * Four levels of 256 slots cover 2^32 ticks, later deadlines are moved
+ * closer as the wheel turns. Entries are added from any thread by pushing
+ * them into a lock-free stack, which the thread of the wheel takes over
+ * on each turn. Cancelled entries only change their state and are dropped
+ * when their slot is reached, so both operations take O(1).
+ * The thread sleeps until the next non empty slot and delivers all
+ * messages expired at once with a single wake of the scheduler.
+ */
+class timer_wheel_t {
+public:
+  using clock = std::chrono::steady_clock;
+
+  timer_wheel_t(runtime_t* const owner, const clock::duration tick);
+  ~timer_wheel_t();
+
+  /// Schedules the entry for the deadline.
+  /// The wheel takes over one reference to the entry.
+  void add(timer_entry_t* const entry,
+           const clock::time_point deadline,
+           const clock::duration period);
+
+  /// Schedules resumption of the suspended handler of the object.
+  /// @return false if pending delays are being expired at once, so the
+  ///         handler should not be suspended.
+  bool add_resume(object_t* const obj, const clock::time_point deadline);
+
+  /// While the wheel is being drained suspended handlers are resumed
+  /// without waiting for their deadlines.
+  void drain(const bool value);
+
+  /// Stops the thread and drops all pending entries.
+  void stop();
+
+  /// Cancels the timer.
+  /// @return false if the message has been sent already or the timer has
+  ///         been cancelled before.
+  static bool cancel(timer_entry_t* const entry);
+
+  /// Releases the reference to the entry.
+  static void release(timer_entry_t* const entry) noexcept;
+
+  /// Releases the message and the target of the entry.
+  static void release_resources(timer_entry_t* const entry);
+
+private:
+  static constexpr unsigned int LEVELS = 4;
+  static constexpr unsigned int SLOT_BITS = 8;
+  static constexpr uint64_t SLOTS = uint64_t(1) << SLOT_BITS;
+  static constexpr uint64_t MASK = SLOTS - 1;
+  /// Maximum distance of a deadline the wheel can hold.
+  static constexpr uint64_t MAX_DELTA =
+    (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+
+  /// Entries of a slot in the order of insertion.
+  struct slot_t {
+    timer_entry_t* head{nullptr};
+    timer_entry_t* tail{nullptr};
+  };
+
+  /// Number of ticks passed since the origin.
+  uint64_t ticks(const clock::time_point time) const noexcept;
+
+  /// Starts the thread unless it is running.
+  /// Called under the lock.
+  void start();
+
+  void execute();
+
+  /// Moves new entries into slots.
+  void take_added();
+
+  /// Places the entry into the slot of its deadline.
+  void insert(timer_entry_t* const entry) noexcept;
+
+  /// Processes the current tick.
+  void advance(std::vector<timer_entry_t*>& expired);
+
+  /// Moves entries of the slot to lower levels.
+  void cascade(const unsigned int level, const uint64_t index);
+
+  /// Collects all entries resuming suspended handlers.
+  void take_resumes(std::vector<timer_entry_t*>& expired);
+
+  /// Tick the thread should be woken at.
+  uint64_t next_tick() const noexcept;
+
+  /// Drops the cancelled entry or adds it to the list.
+  void expire(timer_entry_t* const entry,
+              std::vector<timer_entry_t*>& expired) noexcept;
+
+private:
+  runtime_t* const runtime_;
+  /// Duration of a tick.
+  const clock::duration tick_;
+  /// Time of the zero tick.
+  const clock::time_point origin_;
+  /// Entries added since the last turn.
+  intrusive::mpsc_stack<timer_entry_t> added_;
+  slot_t slots_[LEVELS][SLOTS];
+  /// Next tick to be processed.
+  uint64_t current_{0};
+  /// Number of entries in slots.
+  size_t count_{0};
+  /// Tick the sleeping thread will be woken at.
+  /// Zero while the thread is awake.
+  std::atomic<uint64_t> wake_tick_{0};
+  event wakeup_{true};
+  std::atomic<bool> started_{false};
+  std::atomic<bool> draining_{false};
+  /// Suspended handlers should be resumed at once.
+  std::atomic<bool> drain_requested_{false};
+  std::atomic<bool> stopping_{false};
+  /// Serializes adding of entries with the stop.
+  std::mutex mutex_;
+  std::thread thread_;
+};
+
+} // namespace acto::core
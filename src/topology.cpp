@@ -0,0 +1,114 @@
+#include "topology.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#if defined(__linux__)
+# include <pthread.h>
+# include <sched.h>
+#endif
+
+namespace acto::core {
+namespace {
+
+/// Parses list of CPUs in sysfs format, e.g. "0-3,8-11".
+std::vector<unsigned int> parse_cpu_list(const std::string& text) {
+  std::vector<unsigned int> result;
+  size_t pos = 0;
+
+  while (pos < text.size()) {
+    const size_t end = std::min(text.find(',', pos), text.size());
+    const std::string range = text.substr(pos, end - pos);
+    const size_t dash = range.find('-');
+
+    try {
+      if (dash == std::string::npos) {
+        result.push_back(unsigned(std::stoul(range)));
+      } else {
+        const unsigned long first = std::stoul(range.substr(0, dash));
+        const unsigned long last = std::stoul(range.substr(dash + 1));
+
+        for (unsigned long cpu = first; cpu <= last; ++cpu) {
+          result.push_back(unsigned(cpu));
+        }
+      }
+    } catch (const std::exception&) {
+      // Skip malformed ranges.
+    }
+
+    pos = end + 1;
+  }
+
+  return result;
+}
+
+std::vector<unsigned int> read_cpu_list(const std::string& path) {
+  std::ifstream file(path);
+  std::string text;
+
+  if (file && std::getline(file, text)) {
+    return parse_cpu_list(text);
+  }
+  return {};
+}
+
+} // namespace
+
+std::vector<std::vector<unsigned int>> numa_nodes(const std::string& sysfs) {
+  std::vector<std::vector<unsigned int>> result;
+
+#if defined(__linux__)
+  for (const unsigned int node : read_cpu_list(sysfs + "/node/online")) {
+    auto cpus = read_cpu_list(sysfs + "/node/node" + std::to_string(node) +
+                              "/cpulist");
+    // Nodes without CPUs are useless for workers.
+    if (!cpus.empty()) {
+      result.push_back(std::move(cpus));
+    }
+  }
+
+  if (result.empty()) {
+    if (auto cpus = read_cpu_list(sysfs + "/cpu/online");
+        !cpus.empty())
+    {
+      result.push_back(std::move(cpus));
+    }
+  }
+#else
+  (void)sysfs;
+#endif
+
+  if (result.empty()) {
+    std::vector<unsigned int> cpus;
+
+    for (unsigned int i = 0; i < std::thread::hardware_concurrency(); ++i) {
+      cpus.push_back(i);
+    }
+    result.push_back(std::move(cpus));
+  }
+
+  return result;
+}
+
+bool set_thread_affinity(const std::vector<unsigned int>& cpus) {
+#if defined(__linux__)
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  for (const unsigned int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+
+  return CPU_COUNT(&set) &&
+         pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpus;
+  return false;
+#endif
+}
+
+} // namespace acto::core
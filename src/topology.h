@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace acto::core {
+
+/**
+ * Lists CPUs of every NUMA node in the system.
+ *
+ * Returns a single node with all online CPUs if the topology
+ * cannot be determined.
+ *
+ * @param sysfs directory of system devices in sysfs.
+ */
+std::vector<std::vector<unsigned int>> numa_nodes(
+  const std::string& sysfs = "/sys/devices/system");
+
+/**
+ * Binds the current thread to the given set of CPUs.
+ *
+ * @return false if the platform does not support thread affinity or
+ * the call has failed.
+ */
+bool set_thread_affinity(const std::vector<unsigned int>& cpus);
+
+} // namespace acto::core
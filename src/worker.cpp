@@ -1,14 +1,116 @@
 #include "worker.h"
 #include "runtime.h"
 
+#if defined(__linux__)
+# include <time.h>
+#endif
+
 namespace acto {
 namespace core {
+namespace {
+
+/**
+ * Cheap clock for time slices.
+ *
+ * Coarse clock on Linux has resolution of a scheduler tick that is far
+ * less than typical time slice, but reading it costs a few nanoseconds.
+ */
+std::chrono::steady_clock::time_point slice_clock() noexcept {
+#if defined(__linux__) && defined(CLOCK_MONOTONIC_COARSE)
+  timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) == 0) {
+    const auto since_epoch =
+      std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+
+    return std::chrono::steady_clock::time_point(
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        since_epoch));
+  }
+#endif
+  return std::chrono::steady_clock::now();
+}
+
+} // namespace
+
+bool object_queue_t::push(object_t* const obj) {
+  level_t& level = levels_[unsigned(obj->priority)];
+
+  level.size.fetch_add(1, std::memory_order_relaxed);
+  level.objects.push(obj);
+
+  return size_.fetch_add(1, std::memory_order_release) == 0;
+}
+
+object_t* object_queue_t::pop() {
+  const int top_level = top();
+
+  if (top_level < 0) {
+    return nullptr;
+  }
+  // Serve a starving level first, the lowest one has the precedence.
+  for (int i = 0; i < top_level; ++i) {
+    level_t& level = levels_[i];
+
+    if (level.size.load(std::memory_order_relaxed) == 0) {
+      continue;
+    }
+    if (level.skipped.fetch_add(1, std::memory_order_relaxed) + 1 >=
+        STARVATION_LIMIT)
+    {
+      if (object_t* const obj = pop_level(i)) {
+        return obj;
+      }
+    }
+  }
+
+  for (int i = top_level; i >= 0; --i) {
+    if (object_t* const obj = pop_level(i)) {
+      return obj;
+    }
+  }
+  return nullptr;
+}
+
+int object_queue_t::top() const noexcept {
+  if (empty()) {
+    return -1;
+  }
+  for (int i = LEVELS - 1; i >= 0; --i) {
+    if (levels_[i].size.load(std::memory_order_relaxed)) {
+      return i;
+    }
+  }
+  return -1;
+}
 
-worker_t::worker_t(callbacks* const slots, std::function<void()> init_cb)
-  : slots_(slots) {
+object_t* object_queue_t::pop_level(const unsigned int i) {
+  level_t& level = levels_[i];
+
+  if (level.size.load(std::memory_order_relaxed) == 0) {
+    return nullptr;
+  }
+  object_t* const obj = level.objects.pop();
+  if (obj) {
+    level.skipped.store(0, std::memory_order_relaxed);
+    level.size.fetch_sub(1, std::memory_order_relaxed);
+    size_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  return obj;
+}
+
+worker_t::worker_t(callbacks* const slots,
+                   run_queue_t* const queue,
+                   const quantum_t& quantum,
+                   const std::chrono::nanoseconds spin,
+                   std::function<void(worker_t*)> init_cb)
+  : slots_(slots)
+  , queue_(queue)
+  , quantum_(quantum)
+  , wakeup_event_(true, spin) {
   thread_ = std::thread([this, cb = std::move(init_cb)]() {
     // Call the initialization in thread's context.
-    cb();
+    cb(this);
     // Execute the event loop.
     execute();
   });
@@ -23,15 +125,12 @@ worker_t::~worker_t() {
   }
 }
 
-void worker_t::assign(object_t* const obj,
-                      const std::chrono::steady_clock::duration slice) {
-  assert(!object_ && obj);
+void worker_t::assign(object_t* const obj) {
+  assert(!object_.load() && obj);
 
-  object_ = obj;
-  start_ = std::chrono::steady_clock::now();
-  time_slice_ = slice;
+  object_.store(obj);
   // Acquire the object.
-  runtime_t::instance()->acquire(obj);
+  obj->runtime->acquire(obj);
   // Wakeup the thread.
   wakeup_event_.signaled();
 }
@@ -52,9 +151,43 @@ void worker_t::execute() {
   }
 }
 
+void worker_t::start_slice() noexcept {
+  slice_ = quantum_;
+  handled_ = 0;
+  start_ = slice_clock();
+}
+
+bool worker_t::slice_elapsed() noexcept {
+  ++handled_;
+
+  if (slice_.messages && handled_ >= slice_.messages) {
+    return true;
+  }
+  // Read the clock only once per the interval.
+  if (handled_ % slice_.check_interval) {
+    return false;
+  }
+  if (slice_.time < (slice_clock() - start_)) {
+    return true;
+  }
+  // Let objects of a higher priority to get the worker.
+  return slice_.preemptive && slots_->should_yield(object_.load());
+}
+
+bool worker_t::released(object_t* const obj) {
+  std::lock_guard<std::mutex> g(obj->cs);
+
+  return obj->thread != this;
+}
+
 bool worker_t::process() {
-  while (object_t* const obj = object_) {
+  while (object_t* const obj = object_.load()) {
     bool need_delete = false;
+    bool wait_messages = false;
+    // Remember the node so the object will prefer it next time.
+    obj->node.store(node(), std::memory_order_relaxed);
+
+    start_slice();
 
     while (true) {
       // Handle a message.
@@ -62,50 +195,76 @@ bool worker_t::process() {
         slots_->handle_message(obj, std::move(msg));
         // Continue processing messages if the object is bound to the thread or
         // the time slice has not been elapsed yet.
-        if (obj->exclusive ||
-            time_slice_ >= (std::chrono::steady_clock::now() - start_))
-        {
+        if (obj->exclusive || !slice_elapsed()) {
           continue;
         }
       }
 
       // There are no messages in the object's mailbox or
       // the time slice was elapsed.
-      std::lock_guard<std::mutex> g(obj->cs);
-
-      if (obj->deleting) {
+      if (obj->state.load() & object_t::DELETING) {
         // Drain the object's mailbox if it in the deleting state.
-        if (obj->has_messages()) {
-          time_slice_ = std::chrono::steady_clock::duration::max();
+        if (obj->runnable() || (obj->unschedule() & object_t::SCHEDULED)) {
+          slice_.time = std::chrono::steady_clock::duration::max();
+          slice_.messages = 0;
+          slice_.preemptive = false;
           continue;
         }
-
-        need_delete = true;
-        obj->scheduled = false;
+        // The dedicated thread is kept until the suspended handler
+        // completes.
+        if (obj->exclusive && obj->suspension.load()) {
+          wait_messages = true;
+        } else {
+          need_delete = true;
+        }
       } else if (obj->exclusive) {
         // Just wait for new messages if the object
         // exclusively bound to the thread.
-        return true;
-      } else if (obj->has_messages()) {
-        // Return object to the shared queue.
+        wait_messages = true;
+      } else if (obj->runnable()) {
+        // Return object to the run queue.
         slots_->push_object(obj);
       } else {
-        obj->scheduled = false;
+        const uint32_t state = obj->unschedule();
+
+        if (state & object_t::SCHEDULED) {
+          slots_->push_object(obj);
+        } else if (state & object_t::DELETING) {
+          // The object has been destroyed after the state was checked.
+          // The deconstruction was left to the worker as the object was
+          // still scheduled.
+          need_delete = true;
+        }
       }
 
       break;
     }
 
+    if (wait_messages) {
+      runtime_t::flush_references();
+      return true;
+    }
     if (need_delete) {
       slots_->push_delete(obj);
+      // The deconstruction of an exclusive object is postponed while some
+      // senders are registered. The thread stays with the object, so the
+      // senders can wake it up without the lock.
+      if (obj->exclusive && !released(obj)) {
+        runtime_t::flush_references();
+        return true;
+      }
     }
-    // Release current object.
-    runtime_t::instance()->release(obj);
+    // Release current object along with the references deferred
+    // during the slice.
+    runtime_t::release_deferred(obj);
+    runtime_t::flush_references();
+
+    // Retrieve next object from the local or the shared queue.
+    object_t* const popped = slots_->pop_object();
 
-    // Retrieve next object from the shared queue.
-    if ((object_ = slots_->pop_object())) {
-      start_ = std::chrono::steady_clock::now();
-      runtime_t::instance()->acquire(object_);
+    object_.store(popped);
+    if (popped) {
+      popped->runtime->acquire(popped);
     } else {
       // Nothing to do.
       // Put itself to the idle list.
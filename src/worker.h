@@ -14,6 +14,71 @@ class worker_t;
 struct object_t;
 struct msg_t;
 
+/**
+ * Multi-level queue of runnable objects.
+ *
+ * Objects are served in the order of their priorities. A non empty level
+ * which has been passed over STARVATION_LIMIT times in a row is served
+ * ahead of higher levels, so every runnable object gets a worker after
+ * a bounded number of pops.
+ */
+class object_queue_t {
+public:
+  /// Number of priority levels.
+  static constexpr unsigned int LEVELS = 3;
+  /// Number of pops a non empty level may be passed over.
+  static constexpr unsigned int STARVATION_LIMIT = 8;
+
+public:
+  /// @brief Appends the object to the level of its priority.
+  /// @returns true if the queue was empty.
+  bool push(object_t* const obj);
+
+  /// Retrieves an object of the highest priority
+  /// unless a lower level starves.
+  object_t* pop();
+
+  /// Whether the queue is empty.
+  bool empty() const noexcept {
+    return size_.load(std::memory_order_relaxed) == 0;
+  }
+
+  /// @return highest priority level with runnable objects,
+  ///         or -1 if the queue is empty.
+  int top() const noexcept;
+
+private:
+  object_t* pop_level(const unsigned int level);
+
+private:
+  struct level_t {
+    intrusive::queue<object_t> objects;
+    /// Approximate number of objects in the level.
+    /// Allows to skip empty levels without taking the lock.
+    std::atomic<unsigned long> size{0};
+    /// Number of pops the level has been passed over.
+    std::atomic<unsigned int> skipped{0};
+  };
+
+  level_t levels_[LEVELS];
+  /// Total number of objects in the queue.
+  std::atomic<unsigned long> size_{0};
+};
+
+/**
+ * Queue of runnable objects owned by a worker thread.
+ *
+ * Only the owner thread pushes objects into the queue, while
+ * other workers may steal objects from it when they run out of work.
+ */
+struct alignas(64) run_queue_t : object_queue_t {
+  /// Object woken last by an actor running on the owner.
+  /// The object will be run next by the owner to reuse warm caches.
+  std::atomic<object_t*> next{nullptr};
+  /// NUMA node of the owner.
+  unsigned int node{0};
+};
+
 /**
  * Worker thread.
  */
@@ -32,25 +97,55 @@ public:
     /** Put itself to idle list. */
     virtual void push_idle(worker_t* const) = 0;
 
-    /** Return object to shared queue. */
+    /** Return object to the run queue. */
     virtual void push_object(object_t* const) = 0;
 
     /** Try to acquire additional job. */
     virtual object_t* pop_object() = 0;
+
+    /** Whether objects of a higher priority are waiting for a worker. */
+    virtual bool should_yield(const object_t* const) = 0;
+  };
+
+  /**
+   * Limits of processing of an object in the shared pool.
+   */
+  struct quantum_t {
+    /// Time slice of an object.
+    std::chrono::steady_clock::duration time;
+    /// Maximum number of messages per slice. Zero means unlimited.
+    unsigned int messages;
+    /// The clock is read once per the given number of messages.
+    unsigned int check_interval;
+    /// Yield the worker to objects of a higher priority.
+    bool preemptive;
   };
 
 public:
-  worker_t(callbacks* const slots, std::function<void()> init_cb);
+  worker_t(callbacks* const slots,
+           run_queue_t* const queue,
+           const quantum_t& quantum,
+           const std::chrono::nanoseconds spin,
+           std::function<void(worker_t*)> init_cb);
   ~worker_t();
 
   /**
    * Assigns an object to the worker.
    */
-  void assign(object_t* const obj,
-              const std::chrono::steady_clock::duration slice);
+  void assign(object_t* const obj);
 
   void wakeup();
 
+  /** Local queue of runnable objects. */
+  run_queue_t* queue() const noexcept {
+    return queue_;
+  }
+
+  /** NUMA node the worker belongs to. */
+  unsigned int node() const noexcept {
+    return queue_ ? queue_->node : 0;
+  }
+
 private:
   void execute();
 
@@ -60,17 +155,35 @@ private:
    */
   bool process();
 
+  /** Whether the dedicated thread has been released by the object. */
+  bool released(object_t* const obj);
+
+  /** Starts new slice for the current object. */
+  void start_slice() noexcept;
+
+  /** Accounts a handled message and checks the slice is over. */
+  bool slice_elapsed() noexcept;
+
 private:
   callbacks* const slots_;
+  /// Local queue of runnable objects.
+  run_queue_t* const queue_;
   /// Activity flag.
   std::atomic<bool> active_{true};
   /// Current assigned object.
-  object_t* object_{nullptr};
-
+  /// A stale wakeup may let the thread read it while it is being assigned.
+  std::atomic<object_t*> object_{nullptr};
+
+  /// Limits of the slice.
+  const quantum_t quantum_;
+  /// Limits of the current slice.
+  quantum_t slice_{};
+  /// Start time of the current slice.
   std::chrono::steady_clock::time_point start_{};
-  std::chrono::steady_clock::duration time_slice_{};
+  /// Number of messages handled during the current slice.
+  unsigned int handled_{0};
 
-  event wakeup_event_{true};
+  event wakeup_event_;
   std::thread thread_;
 };
 
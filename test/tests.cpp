@@ -1,17 +1,59 @@
 #include "catch.hpp"
+#include "topology.h"
 #include <acto/acto.h>
 #include <acto/util.h>
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <future>
 #include <iostream>
 #include <map>
+#include <mutex>
+#include <set>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#if defined(__linux__)
+# include <sched.h>
+#endif
+
+// Should be the first test, as the allocator can be replaced only
+// before any message is allocated.
+TEST_CASE("Custom message allocator") {
+  static std::atomic<int> allocated{0};
+
+  REQUIRE(acto::set_message_allocator(
+    {[](size_t size) {
+       ++allocated;
+       return acto::default_message_allocator().allocate(size);
+     },
+     [](void* ptr, size_t size) {
+       --allocated;
+       acto::default_message_allocator().deallocate(ptr, size);
+     }}));
+
+  auto msg = std::make_unique<acto::core::msg_wrap_t<int>>(1);
+  CHECK(allocated == 1);
+  msg.reset();
+  CHECK(allocated == 0);
+
+  // The allocator is kept for the rest of the tests.
+  CHECK_FALSE(acto::set_message_allocator({}));
+}
+
 TEST_CASE("Finalize library") {
   acto::shutdown();
 }
 
+TEST_CASE("Configure started runtime") {
+  // The runtime has been started by the previous test.
+  CHECK_FALSE(acto::configure(acto::runtime_config{}));
+}
+
 TEST_CASE("Uninitialized") {
   acto::destroy(acto::actor_ref());
   acto::destroy_and_wait(acto::actor_ref());
@@ -246,3 +288,1864 @@ TEST_CASE("Send from bootstrap") {
 
   CHECK(valid_sender);
 }
+
+TEST_CASE("Event") {
+  using acto::core::event;
+  using acto::core::wait_result;
+
+  SECTION("Auto reset") {
+    event ev(true);
+
+    ev.signaled();
+    CHECK(ev.wait() == wait_result::signaled);
+    CHECK(ev.wait(std::chrono::milliseconds(10)) == wait_result::timeout);
+  }
+
+  SECTION("Manual reset") {
+    event ev;
+
+    ev.signaled();
+    CHECK(ev.wait() == wait_result::signaled);
+    CHECK(ev.wait(std::chrono::milliseconds(10)) == wait_result::signaled);
+    ev.reset();
+    CHECK(ev.wait(std::chrono::milliseconds(10)) == wait_result::timeout);
+  }
+
+  SECTION("Wakeup parked thread") {
+    event ev(true, std::chrono::microseconds(50));
+    std::atomic<int> counter{0};
+    std::thread t([&] {
+      for (int i = 0; i < 1000; ++i) {
+        ev.wait();
+        counter++;
+      }
+    });
+
+    while (counter < 1000) {
+      ev.signaled();
+      std::this_thread::yield();
+    }
+    t.join();
+
+    CHECK(counter == 1000);
+  }
+}
+
+TEST_CASE("Multiple runtimes") {
+  struct Echo : acto::actor {
+    struct M {
+      int value;
+    };
+
+    Echo() {
+      actor::handler<M>([](acto::actor_ref sender, const M& m) {
+        sender.send(M{m.value + 1});
+      });
+    }
+  };
+
+  struct Client : acto::actor {
+    Client(std::atomic<int>& result) {
+      actor::handler<Echo::M>([&result, this](const Echo::M& m) {
+        result = m.value;
+        actor::die();
+      });
+    }
+
+    void bootstrap() override {
+      context().send(Echo::M{1});
+    }
+  };
+
+  // The reference outlives the runtime.
+  acto::actor_ref echo;
+  {
+    acto::runtime latency;
+    acto::runtime batch(acto::runtime_config{.concurrency = 1});
+    std::atomic<int> result{0};
+
+    echo = acto::spawn<Echo>(latency);
+    // Use the echo actor as a context for the client.
+    acto::join(acto::spawn<Client>(batch, echo, result));
+
+    CHECK(result == 2);
+  }
+  // Actors are stopped with the runtime.
+  CHECK_FALSE(echo.send(Echo::M{0}));
+}
+
+#if defined(__linux__)
+TEST_CASE("CPU affinity") {
+  struct A : acto::actor {
+    struct M { };
+
+    A(std::atomic<int>& cpu) {
+      actor::handler<M>([&cpu, this] {
+        cpu = sched_getcpu();
+        actor::die();
+      });
+    }
+  };
+
+  cpu_set_t allowed;
+
+  REQUIRE(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+  // Take the last CPU the process is allowed to run on.
+  unsigned int target = 0;
+
+  for (unsigned int i = 0; i < CPU_SETSIZE; ++i) {
+    if (CPU_ISSET(i, &allowed)) {
+      target = i;
+    }
+  }
+
+  acto::runtime_config config;
+  config.cpus = {target};
+
+  acto::runtime rt(config);
+  std::atomic<int> cpu{-1};
+
+  const auto a = acto::spawn<A>(rt, cpu);
+
+  a.send(A::M());
+  acto::join(a);
+
+  CHECK(cpu == int(target));
+}
+
+TEST_CASE("NUMA topology") {
+  const auto root = std::filesystem::temp_directory_path() / "acto-sysfs";
+  // Writes a single line file creating the directories.
+  const auto write = [&root](const std::string& path, const char* text) {
+    const auto file = root / path;
+
+    std::filesystem::create_directories(file.parent_path());
+    std::ofstream(file) << text << '\n';
+  };
+  using nodes = std::vector<std::vector<unsigned int>>;
+
+  std::filesystem::remove_all(root);
+
+  SECTION("missing sysfs") {
+    std::vector<unsigned int> all;
+
+    for (unsigned int i = 0; i < std::thread::hardware_concurrency(); ++i) {
+      all.push_back(i);
+    }
+    CHECK(acto::core::numa_nodes(root.string()) == nodes{all});
+  }
+
+  SECTION("no nodes") {
+    write("cpu/online", "0-3");
+
+    CHECK(acto::core::numa_nodes(root.string()) == nodes{{0, 1, 2, 3}});
+  }
+
+  SECTION("partial nodes") {
+    write("cpu/online", "0-7");
+    write("node/online", "0-2");
+    write("node/node0/cpulist", "0-1,4");
+    // A node without CPUs.
+    write("node/node1/cpulist", "");
+    // The list of node 2 is missing.
+
+    CHECK(acto::core::numa_nodes(root.string()) == nodes{{0, 1, 4}});
+  }
+
+  SECTION("malformed list") {
+    write("node/online", "0,x,1");
+    write("node/node0/cpulist", "0-1,a-b");
+    write("node/node1/cpulist", "2,,3");
+
+    CHECK(acto::core::numa_nodes(root.string()) ==
+          nodes{{0, 1}, {2, 3}});
+  }
+
+  std::filesystem::remove_all(root);
+}
+#endif
+
+TEST_CASE("Message quantum") {
+  struct Loop : acto::actor {
+    struct M { };
+
+    Loop(const int id,
+         std::atomic<bool>& go,
+         std::mutex& mutex,
+         std::vector<int>& trace) {
+      actor::handler<M>([id, &go, &mutex, &trace, this] {
+        // Let the other actor to be scheduled first.
+        while (!go) {
+          std::this_thread::yield();
+        }
+
+        std::lock_guard<std::mutex> g(mutex);
+
+        trace.push_back(id);
+        if (trace.size() < 2000) {
+          self().send(M());
+        } else {
+          actor::die();
+        }
+      });
+    }
+
+    void bootstrap() override {
+      self().send(M());
+    }
+  };
+
+  acto::runtime_config config;
+  // Switch actors after every few messages.
+  config.concurrency = 1;
+  config.slice_messages = 3;
+  config.slice_check_interval = 16;
+
+  acto::runtime rt(config);
+  std::atomic<bool> go{false};
+  std::mutex mutex;
+  std::vector<int> trace;
+
+  const auto a = acto::spawn<Loop>(rt, 0, go, mutex, trace);
+  const auto b = acto::spawn<Loop>(rt, 1, go, mutex, trace);
+
+  go = true;
+  acto::join(a);
+  acto::join(b);
+
+  // Lengths of the runs while both actors are active.
+  const auto first = std::find(trace.begin(), trace.end(), 1);
+  const auto last = std::find(trace.rbegin(), trace.rend(), 1 - trace.back());
+  std::vector<size_t> runs;
+
+  REQUIRE(first != trace.end());
+  for (auto it = first; it != last.base(); ++it) {
+    if (it == first || *it != *(it - 1)) {
+      runs.push_back(0);
+    }
+    ++runs.back();
+  }
+
+  CHECK(runs.size() > 100);
+  CHECK(*std::max_element(runs.begin(), runs.end()) <= 3);
+}
+
+TEST_CASE("Actor priorities") {
+  struct Loop : acto::actor {
+    struct M { };
+
+    Loop() {
+      actor::handler<M>([this] { self().send(M()); });
+    }
+
+    void bootstrap() override {
+      self().send(M());
+    }
+  };
+
+  struct Control : acto::actor {
+    struct M { };
+
+    Control(acto::core::event& ev) {
+      actor::handler<M>([&ev] { ev.signaled(); });
+    }
+  };
+
+  acto::runtime_config config;
+  // Single worker with a slice which is much longer than the test.
+  config.concurrency = 1;
+  config.max_workers = 1;
+  config.time_slice = std::chrono::seconds(60);
+
+  acto::runtime rt(config);
+  acto::core::event ev;
+
+  for (int i = 0; i < 4; ++i) {
+    acto::spawn<Loop>(rt, acto::actor_priority::low);
+  }
+
+  const auto control = acto::spawn<Control>(rt, acto::actor_priority::high, ev);
+
+  control.send(Control::M());
+  // The control actor takes the worker over from the busy ones.
+  CHECK(ev.wait(std::chrono::seconds(10)) == acto::core::wait_result::signaled);
+}
+
+TEST_CASE("Blocking section") {
+  struct Signal : acto::actor {
+    struct M { };
+
+    Signal(acto::core::event& ev) {
+      actor::handler<M>([&ev] { ev.signaled(); });
+    }
+  };
+
+  struct Waiter : acto::actor {
+    struct M { };
+
+    Waiter(acto::core::event& ev, std::atomic<bool>& result) {
+      actor::handler<M>([&ev, &result, this] {
+        // The message is placed into the local queue of the worker.
+        context().send(Signal::M());
+        // Only a compensating worker can handle it.
+        result = acto::blocking([&ev] {
+          return ev.wait(std::chrono::seconds(10)) ==
+                 acto::core::wait_result::signaled;
+        });
+        actor::die();
+      });
+    }
+  };
+
+  acto::runtime_config config;
+  config.concurrency = 1;
+  config.max_workers = 1;
+
+  acto::runtime rt(config);
+  acto::core::event ev;
+  std::atomic<bool> result{false};
+
+  // Use the signal actor as a context for the waiter.
+  const auto waiter =
+    acto::spawn<Waiter>(rt, acto::spawn<Signal>(rt, ev), ev, result);
+
+  waiter.send(Waiter::M());
+  acto::join(waiter);
+
+  CHECK(result);
+  // Blocking outside of the pool just calls the function.
+  CHECK(acto::blocking([] { return 1; }) == 1);
+}
+
+TEST_CASE("Next slot") {
+  struct hop_t {
+    int actor;
+    std::thread::id thread;
+  };
+
+  struct trace_t {
+    std::mutex mutex;
+    std::vector<hop_t> hops;
+    std::atomic<bool> done{false};
+
+    void record(const int actor) {
+      std::lock_guard<std::mutex> g(mutex);
+      hops.push_back(hop_t{actor, std::this_thread::get_id()});
+    }
+  };
+
+  struct Player : acto::actor {
+    struct M {
+      int value;
+    };
+
+    Player(const int id, const int count, trace_t& trace) {
+      actor::handler<M>([=, &trace, this](acto::actor_ref sender, const M& m) {
+        trace.record(id);
+        if (m.value == count) {
+          trace.done = true;
+          actor::die();
+        } else {
+          sender.send(M{m.value + 1});
+        }
+      });
+    }
+  };
+
+  // Stays runnable in the local queue of the worker while players are active.
+  struct Queued : acto::actor {
+    struct M { };
+
+    Queued(trace_t& trace) {
+      actor::handler<M>([&trace, this] {
+        trace.record(0);
+        if (!trace.done) {
+          self().send(M());
+        }
+      });
+    }
+
+    void bootstrap() override {
+      self().send(M());
+    }
+  };
+
+  // Blocks workers until all of them are running.
+  struct Gate : acto::actor {
+    struct M { };
+
+    Gate(std::atomic<int>& running, const int count) {
+      actor::handler<M>([&running, count] {
+        ++running;
+        while (running < count) {
+          std::this_thread::yield();
+        }
+      });
+    }
+  };
+
+  constexpr int count = 1000;
+  acto::runtime_config config;
+  trace_t trace;
+
+  SECTION("woken actor runs on the sender's thread") {
+    config.concurrency = 2;
+    config.next_slot_limit = count;
+
+    acto::runtime rt(config);
+    std::atomic<int> running{0};
+    // Start both workers and let them to park, so the woken actor could be
+    // handed to the idle one if not placed into the next slot.
+    const auto g1 = acto::spawn<Gate>(rt, running, 2);
+    const auto g2 = acto::spawn<Gate>(rt, running, 2);
+
+    g1.send(Gate::M());
+    g2.send(Gate::M());
+    while (running < 2) {
+      std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    const auto a = acto::spawn<Player>(rt, 1, count, trace);
+    const auto b = acto::spawn<Player>(rt, 2, count, trace);
+
+    a.send_on_behalf(b, Player::M{0});
+    acto::join(a);
+
+    std::lock_guard<std::mutex> g(trace.mutex);
+    REQUIRE(trace.hops.size() == count + 1);
+    // Count hops run by a worker other than the one of the sender.
+    size_t moved = 0;
+
+    for (size_t i = 1; i < trace.hops.size(); ++i) {
+      moved += (trace.hops[i].thread != trace.hops[i - 1].thread) ? 1 : 0;
+    }
+
+    CHECK(moved == 0);
+  }
+
+  SECTION("queued actor gets a turn after the limit") {
+    config.concurrency = 1;
+    config.slice_messages = 1;
+    config.next_slot_limit = 2;
+
+    acto::runtime rt(config);
+    const auto q = acto::spawn<Queued>(rt, trace);
+    const auto a = acto::spawn<Player>(rt, 1, count, trace);
+    const auto b = acto::spawn<Player>(rt, 2, count, trace);
+
+    a.send_on_behalf(b, Player::M{0});
+    acto::join(a);
+    acto::destroy(q);
+
+    std::lock_guard<std::mutex> g(trace.mutex);
+    const auto& hops = trace.hops;
+    // The run of players between turns of the queued actor consists of
+    // one run from the local queue followed by slot runs.
+    size_t longest = 0;
+    size_t turns = 0;
+    size_t players = 0;
+
+    for (size_t i = 0; i < hops.size(); ++i) {
+      REQUIRE(hops[i].thread == hops[0].thread);
+      if (hops[i].actor) {
+        ++players;
+      } else {
+        longest = std::max(longest, players);
+        turns += players ? 1 : 0;
+        players = 0;
+      }
+    }
+
+    CHECK(turns > 100);
+    CHECK(longest > 1);
+    CHECK(longest <= config.next_slot_limit + 1);
+  }
+}
+
+TEST_CASE("Bounded mailbox") {
+  struct A : acto::actor {
+    struct M {
+      int value;
+    };
+
+    A(const acto::overflow_policy policy, std::vector<int>& values) {
+      actor::mailbox_capacity(2, policy);
+      actor::handler<M>([&values](const M& m) { values.push_back(m.value); });
+    }
+  };
+
+  std::vector<int> values;
+
+  SECTION("reject") {
+    auto a = acto::spawn<A>(acto::actor_thread::bind,
+                            acto::overflow_policy::reject, values);
+
+    CHECK(a.send(A::M{1}));
+    CHECK(a.send(A::M{2}));
+    CHECK_FALSE(a.send(A::M{3}));
+    CHECK_FALSE(a.try_send(A::M{3}));
+
+    acto::this_thread::process_messages();
+    CHECK(values == std::vector<int>{1, 2});
+    CHECK(a.try_send(A::M{3}));
+    acto::destroy(a);
+  }
+
+  SECTION("drop oldest") {
+    auto a = acto::spawn<A>(acto::actor_thread::bind,
+                            acto::overflow_policy::drop_oldest, values);
+
+    CHECK(a.send(A::M{1}));
+    CHECK(a.send(A::M{2}));
+    CHECK(a.send(A::M{3}));
+    CHECK_FALSE(a.try_send(A::M{4}));
+
+    acto::this_thread::process_messages();
+    CHECK(values == std::vector<int>{2, 3});
+    acto::destroy(a);
+  }
+
+  SECTION("drop oldest accepts the newest") {
+    auto a = acto::spawn<A>(acto::actor_thread::bind,
+                            acto::overflow_policy::drop_oldest, values);
+    // The sender discards the oldest messages itself as the actor
+    // does not take them.
+    for (int i = 1; i <= 100; ++i) {
+      CHECK(a.send(A::M{i}));
+    }
+
+    acto::this_thread::process_messages();
+    CHECK(values == std::vector<int>{99, 100});
+    acto::destroy(a);
+  }
+
+  SECTION("block") {
+    auto a = acto::spawn<A>(acto::actor_thread::bind,
+                            acto::overflow_policy::block, values);
+    std::atomic<bool> done{false};
+    bool sent = true;
+
+    std::thread sender([&] {
+      for (int i = 1; i <= 10; ++i) {
+        sent = a.send(A::M{i}) && sent;
+      }
+      done = true;
+    });
+
+    while (!done) {
+      acto::this_thread::process_messages();
+    }
+    sender.join();
+    acto::this_thread::process_messages();
+
+    CHECK(sent);
+    CHECK(values == std::vector<int>{1, 2, 3, 4, 5, 6, 7, 8, 9, 10});
+    acto::destroy(a);
+  }
+
+  acto::this_thread::process_messages();
+}
+
+TEST_CASE("Dispatch table") {
+  struct A : acto::actor {
+    struct M1 { };
+    struct M2 { };
+    struct M3 { };
+
+    A(std::vector<int>& values) {
+      // Id of M3 is assigned before ids of other types,
+      // so the table will be extended to the front.
+      actor::handler<M1>([&values] { values.push_back(1); });
+      actor::handler<M3>([&values] { values.push_back(3); });
+      actor::handler<M2>([&values] { values.push_back(2); });
+      actor::handler<M2>();
+    }
+  };
+
+  const auto id3 = acto::core::type_id<A::M3>();
+  const auto id1 = acto::core::type_id<A::M1>();
+
+  CHECK(id3 < id1);
+  CHECK(acto::core::type_id<const A::M1>() == acto::core::type_id<A::M1>());
+
+  std::vector<int> values;
+  auto a = acto::spawn<A>(acto::actor_thread::bind, values);
+
+  a.send(A::M1());
+  a.send(A::M2());
+  a.send(A::M3());
+  acto::destroy(a);
+  acto::this_thread::process_messages();
+
+  CHECK(values == std::vector<int>{1, 3});
+}
+
+TEST_CASE("Move only handler") {
+  struct A : acto::actor {
+    struct M { };
+
+    A(int& result) {
+      // Neither move-only nor mutable functors need to be copied.
+      actor::handler<M>(
+        [&result, value = std::make_unique<int>(0)]() mutable {
+          result = ++*value;
+        });
+    }
+  };
+
+  int result = 0;
+  auto a = acto::spawn<A>(acto::actor_thread::bind, result);
+
+  a.send(A::M());
+  a.send(A::M());
+  acto::destroy(a);
+  acto::this_thread::process_messages();
+
+  CHECK(result == 2);
+}
+
+TEST_CASE("Message allocator") {
+  struct alignas(128) Aligned {
+    char data[8];
+  };
+  struct Large {
+    char data[1024];
+  };
+
+  using small_t = acto::core::msg_wrap_t<int>;
+  std::vector<std::unique_ptr<acto::core::msg_t>> msgs;
+
+  // Free on other thread blocks allocated by a finished thread.
+  std::thread([&msgs] {
+    for (int i = 0; i < 10000; ++i) {
+      msgs.push_back(std::make_unique<small_t>(i));
+    }
+  }).join();
+  msgs.clear();
+  // The heap of the finished thread will be reused.
+  std::thread([&msgs] {
+    for (int i = 0; i < 10000; ++i) {
+      msgs.push_back(std::make_unique<small_t>(i));
+    }
+  }).join();
+
+  // Blocks freed by another thread return to the heap of the owner.
+  size_t reused = 0;
+
+  std::thread([&reused] {
+    // A size class not used elsewhere.
+    using block_t = acto::core::msg_wrap_t<std::array<char, 424>>;
+    std::vector<std::unique_ptr<acto::core::msg_t>> blocks;
+    std::set<const void*> addresses;
+
+    for (int i = 0; i < 1000; ++i) {
+      blocks.push_back(std::make_unique<block_t>());
+      addresses.insert(blocks.back().get());
+    }
+    std::thread([&blocks] { blocks.clear(); }).join();
+
+    for (int i = 0; i < 1000; ++i) {
+      blocks.push_back(std::make_unique<block_t>());
+      reused += addresses.count(blocks.back().get());
+    }
+  }).join();
+
+  CHECK(reused == 1000);
+
+  msgs.push_back(std::make_unique<acto::core::msg_wrap_t<Aligned>>());
+  msgs.push_back(std::make_unique<acto::core::msg_wrap_t<Large>>());
+
+  CHECK(reinterpret_cast<uintptr_t>(msgs.back().get()) % alignof(Large) == 0);
+  CHECK(reinterpret_cast<uintptr_t>(msgs[msgs.size() - 2].get()) % 128 == 0);
+  CHECK(static_cast<small_t&>(*msgs.front()).data() == 0);
+  msgs.clear();
+
+  // Messages allocated while the thread is exiting borrow a heap.
+  static thread_local struct late_t {
+    std::unique_ptr<acto::core::msg_t> msg;
+
+    ~late_t() {
+      msg.reset();
+      msg = std::make_unique<small_t>(2);
+      msg.reset();
+    }
+  } late;
+
+  std::thread([] {
+    // Constructed before the heap of the thread, so destroyed after it.
+    late.msg = nullptr;
+    late.msg = std::make_unique<small_t>(1);
+  }).join();
+
+  // Messages have been allocated already.
+  CHECK_FALSE(acto::set_message_allocator({}));
+}
+
+TEST_CASE("Sender references") {
+  struct Echo : acto::actor {
+    struct M { };
+
+    Echo() {
+      actor::handler<M>([](acto::actor_ref sender) { sender.send(M()); });
+    }
+  };
+
+  struct Source : acto::actor {
+    struct Start {
+      acto::actor_ref echo;
+      int count;
+    };
+
+    Source(int& replies) {
+      actor::handler<Start>([this](const Start& m) {
+        count_ = m.count;
+        for (int i = 0; i < m.count; ++i) {
+          m.echo.send(Echo::M());
+        }
+      });
+      actor::handler<Echo::M>([this, &replies] {
+        if (++replies == count_) {
+          actor::die();
+        }
+      });
+    }
+
+  private:
+    int count_{0};
+  };
+
+  // References to the senders taken in batches are released with
+  // the runtime, which is checked by the leak sanitizer.
+  acto::runtime rt;
+  int replies = 0;
+
+  const auto echo = acto::spawn<Echo>(rt);
+  const auto source = acto::spawn<Source>(rt, replies);
+
+  source.send(Source::Start{echo, 1000});
+  acto::join(source);
+  acto::destroy(echo);
+
+  CHECK(replies == 1000);
+}
+
+TEST_CASE("Work distribution") {
+  struct Child : acto::actor {
+    struct M { };
+
+    Child(const std::thread::id parent, std::atomic<int>& elsewhere) {
+      actor::handler<M>([parent, &elsewhere] {
+        if (std::this_thread::get_id() != parent) {
+          ++elsewhere;
+        }
+      });
+    }
+  };
+
+  // Occupies a worker until released.
+  struct Busy : acto::actor {
+    struct M { };
+
+    Busy(std::atomic<bool>& running, std::atomic<bool>& release) {
+      actor::handler<M>([&running, &release] {
+        running = true;
+        while (!release) {
+          std::this_thread::yield();
+        }
+      });
+    }
+  };
+
+  struct Parent : acto::actor {
+    struct M {
+      int count;
+      bool wait_idle;
+    };
+
+    Parent(std::atomic<bool>& running,
+           std::atomic<bool>& release,
+           std::atomic<int>& elsewhere) {
+      actor::handler<M>([&, this](const M& m) {
+        while (!running) {
+          std::this_thread::yield();
+        }
+        if (m.wait_idle) {
+          release = true;
+          // Let the other worker to park itself.
+          std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        for (int i = 0; i < m.count; ++i) {
+          acto::spawn<Child>(std::this_thread::get_id(), elsewhere)
+            .send(Child::M());
+        }
+        release = true;
+        // The worker is kept busy, so only the other one can handle
+        // the children.
+        const auto deadline =
+          std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+        while (elsewhere < m.count &&
+               std::chrono::steady_clock::now() < deadline)
+        {
+          std::this_thread::yield();
+        }
+        actor::die();
+      });
+    }
+  };
+
+  acto::runtime_config config;
+  config.concurrency = 2;
+  // Do not let the children to wait in the next slot of the worker.
+  config.next_slot_limit = 0;
+
+  acto::runtime rt(config);
+  std::atomic<bool> running{false};
+  std::atomic<bool> release{false};
+  std::atomic<int> elsewhere{0};
+
+  const auto busy = acto::spawn<Busy>(rt, running, release);
+  const auto parent = acto::spawn<Parent>(rt, running, release, elsewhere);
+
+  busy.send(Busy::M());
+
+  SECTION("stealing") {
+    // The children are placed into the local queue of the worker, as the
+    // other worker is busy at the moment.
+    parent.send(Parent::M{4, false});
+    acto::join(parent);
+
+    CHECK(elsewhere == 4);
+  }
+
+  SECTION("handoff to an idle worker") {
+    parent.send(Parent::M{1, true});
+    acto::join(parent);
+
+    CHECK(elsewhere == 1);
+  }
+
+  acto::destroy(busy);
+}
+
+TEST_CASE("Spawn from handlers") {
+  struct Child : acto::actor {
+    Child(std::atomic<int>& destroyed)
+      : destroyed_(destroyed) {
+    }
+
+    ~Child() {
+      ++destroyed_;
+    }
+
+  private:
+    std::atomic<int>& destroyed_;
+  };
+
+  struct Parent : acto::actor {
+    struct M {
+      int count;
+    };
+
+    Parent(std::atomic<int>& destroyed) {
+      actor::handler<M>([&destroyed, this](const M& m) {
+        for (int i = 0; i < m.count; ++i) {
+          auto child = acto::spawn<Child>(destroyed);
+          // Leave a half of the children to the shutdown.
+          if (i % 2) {
+            acto::destroy(child);
+          }
+        }
+        actor::die();
+      });
+    }
+  };
+
+  std::atomic<int> destroyed{0};
+  {
+    acto::runtime rt;
+    std::vector<acto::actor_ref> parents;
+
+    for (int i = 0; i < 4; ++i) {
+      parents.push_back(acto::spawn<Parent>(rt, destroyed));
+      parents.back().send(Parent::M{250});
+    }
+    for (const auto& parent : parents) {
+      acto::join(parent);
+    }
+
+    CHECK(destroyed == 500);
+
+    rt.shutdown();
+  }
+
+  CHECK(destroyed == 1000);
+}
+
+TEST_CASE("Concurrent destroy") {
+  struct M { };
+
+  struct Stop { };
+
+  struct Block { };
+
+  // Counts messages, stops on request or blocks until released.
+  struct A : acto::actor {
+    A(std::atomic<int>& count, std::atomic<bool>& release) {
+      actor::handler<M>([&count]() { count.fetch_add(1); });
+      actor::handler<Stop>([this]() { actor::die(); });
+      actor::handler<Block>([&release]() {
+        while (!release.load()) {
+          std::this_thread::yield();
+        }
+      });
+    }
+  };
+
+  // The object should be deconstructed in time.
+  auto joined = [](const acto::actor_ref& ref) {
+    auto done = std::make_shared<std::promise<void>>();
+    auto f = done->get_future();
+    // The thread is left waiting if the object is never deconstructed.
+    std::thread([ref, done] {
+      acto::join(ref);
+      done->set_value();
+    }).detach();
+
+    return f.wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+  };
+
+  std::atomic<int> count{0};
+  std::atomic<bool> release{false};
+
+  SECTION("destroy racing with sender") {
+    for (int i = 0; i < 200; ++i) {
+      auto a = acto::spawn<A>(count, release);
+      std::atomic<bool> stop{false};
+      std::thread sender([&] {
+        while (!stop.load()) {
+          a.send(M{});
+        }
+      });
+
+      while (count.load() < i) {
+        std::this_thread::yield();
+      }
+      acto::destroy(a);
+      REQUIRE(joined(a));
+      stop = true;
+      sender.join();
+    }
+  }
+
+  SECTION("die racing with sender") {
+    for (int i = 0; i < 200; ++i) {
+      auto a = acto::spawn<A>(count, release);
+      std::atomic<bool> stop{false};
+      std::thread sender([&] {
+        while (!stop.load()) {
+          a.send(M{});
+        }
+      });
+
+      a.send(Stop{});
+      REQUIRE(joined(a));
+      stop = true;
+      sender.join();
+    }
+  }
+
+  SECTION("idle exclusive actor") {
+    for (int i = 0; i < 20; ++i) {
+      auto a = acto::spawn<A>(acto::actor_thread::exclusive, count, release);
+
+      a.send(M{});
+      while (count.load() <= i) {
+        std::this_thread::yield();
+      }
+      // The dedicated thread waits for messages.
+      acto::destroy(a);
+      REQUIRE(joined(a));
+    }
+  }
+
+  SECTION("exclusive actor destroyed while senders spin") {
+    for (int i = 0; i < 20; ++i) {
+      auto a = acto::spawn<A>(acto::actor_thread::exclusive, count, release);
+      std::atomic<bool> stop{false};
+      std::vector<std::thread> senders;
+
+      for (int j = 0; j < 3; ++j) {
+        senders.emplace_back([&] {
+          while (!stop.load()) {
+            a.send(M{});
+          }
+        });
+      }
+      while (count.load() < 100 * (i + 1)) {
+        std::this_thread::yield();
+      }
+      // The dedicated thread completes the deconstruction after the last
+      // sender leaves.
+      acto::destroy(a);
+      REQUIRE(joined(a));
+      stop = true;
+      for (auto& t : senders) {
+        t.join();
+      }
+    }
+  }
+
+  SECTION("rejected while deleting") {
+    auto a = acto::spawn<A>(count, release);
+
+    a.send(Block{});
+    a.send(M{});
+    acto::destroy(a);
+    // The body is alive while the handler runs, but the object does not
+    // accept messages anymore.
+    CHECK_FALSE(a.send(M{}));
+    release = true;
+    REQUIRE(joined(a));
+    // Messages sent before the destruction are handled.
+    CHECK(count == 1);
+    CHECK_FALSE(a.send(M{}));
+  }
+
+  SECTION("messages arriving while unscheduled") {
+    constexpr int SENDERS = 4;
+    constexpr int MESSAGES = 20000;
+    auto a = acto::spawn<A>(count, release);
+    std::vector<std::thread> senders;
+
+    for (int i = 0; i < SENDERS; ++i) {
+      senders.emplace_back([&a, i] {
+        for (int j = 0; j < MESSAGES; ++j) {
+          a.send(M{});
+          // Let the actor run out of messages now and then.
+          if ((j + i) % 64 == 0) {
+            std::this_thread::yield();
+          }
+        }
+      });
+    }
+    for (auto& t : senders) {
+      t.join();
+    }
+
+    const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+    while (count.load() < SENDERS * MESSAGES &&
+           std::chrono::steady_clock::now() < deadline)
+    {
+      std::this_thread::yield();
+    }
+    // No message is left in the mailbox of an unscheduled object.
+    CHECK(count == SENDERS * MESSAGES);
+
+    acto::destroy(a);
+    REQUIRE(joined(a));
+  }
+}
+
+TEST_CASE("Batch send") {
+  struct A : acto::actor {
+    struct M {
+      int value;
+    };
+
+    A(std::vector<int>& values) {
+      actor::handler<M>([&values](const M& m) { values.push_back(m.value); });
+    }
+
+    A(std::vector<int>& values, const size_t capacity)
+      : A(values) {
+      actor::mailbox_capacity(capacity);
+    }
+  };
+
+  std::vector<int> values;
+
+  SECTION("order") {
+    auto a = acto::spawn<A>(acto::actor_thread::bind, values);
+    acto::message_batch batch;
+
+    CHECK(a.send(A::M{0}));
+    for (int i = 1; i <= 3; ++i) {
+      batch.add(A::M{i});
+    }
+    batch.emplace<A::M>(4);
+    CHECK(batch.size() == 4);
+    CHECK(a.send_batch(std::move(batch)));
+    CHECK(batch.empty());
+    CHECK(a.send(A::M{5}));
+
+    acto::this_thread::process_messages();
+    CHECK(values == std::vector<int>{0, 1, 2, 3, 4, 5});
+    acto::destroy(a);
+  }
+
+  SECTION("bounded mailbox") {
+    auto a = acto::spawn<A>(acto::actor_thread::bind, values, size_t(3));
+    acto::message_batch batch;
+
+    batch.add(A::M{1});
+    batch.add(A::M{2});
+    CHECK(a.send_batch(std::move(batch)));
+    // The whole batch should fit into the mailbox.
+    batch.add(A::M{3});
+    batch.add(A::M{4});
+    CHECK_FALSE(a.send_batch(std::move(batch)));
+    CHECK(batch.empty());
+    CHECK(a.send(A::M{3}));
+
+    acto::this_thread::process_messages();
+    CHECK(values == std::vector<int>{1, 2, 3});
+    acto::destroy(a);
+  }
+}
+
+TEST_CASE("Multicast") {
+  struct M {
+    M(int v, std::atomic<int>& c)
+      : value(v)
+      , copies(c) {
+    }
+
+    M(const M& other)
+      : value(other.value)
+      , copies(other.copies) {
+      ++copies;
+    }
+
+    M(M&&) = default;
+
+    int value;
+    std::atomic<int>& copies;
+  };
+
+  struct A : acto::actor {
+    A(std::atomic<int>& sum, const bool by_value) {
+      if (by_value) {
+        actor::handler<M>([&sum](M&& m) { sum += m.value; });
+      } else {
+        actor::handler<M>(
+          [&sum](acto::actor_ref, const M& m) { sum += m.value; });
+      }
+    }
+  };
+
+  acto::runtime rt;
+  std::atomic<int> copies{0};
+  std::atomic<int> sum{0};
+  std::vector<acto::actor_ref> targets;
+
+  for (int i = 0; i < 8; ++i) {
+    targets.push_back(acto::spawn<A>(rt, sum, i == 0));
+  }
+  // Empty references and deleted actors are skipped.
+  targets.push_back(acto::actor_ref());
+  targets.push_back(acto::spawn<A>(rt, sum, false));
+  acto::destroy_and_wait(targets.back());
+
+  CHECK(acto::multicast(targets, M(1, copies)) == 8);
+
+  for (size_t i = 0; i < 8; ++i) {
+    acto::destroy_and_wait(targets[i]);
+  }
+
+  CHECK(sum == 8);
+  // Only the handler taking the message by value gets a copy.
+  CHECK(copies == 1);
+}
+
+TEST_CASE("Bulk spawn") {
+  struct alignas(128) A : acto::actor {
+    struct M {
+      int value;
+    };
+
+    A(std::atomic<int>& handled, std::atomic<int>& destroyed)
+      : destroyed_(destroyed) {
+      actor::handler<M>([&handled, this](const M& m) {
+        // Bodies placed into an arena should be properly aligned.
+        if (reinterpret_cast<uintptr_t>(this) % alignof(A) == 0) {
+          handled += m.value;
+        }
+      });
+    }
+
+    ~A() {
+      ++destroyed_;
+    }
+
+  private:
+    std::atomic<int>& destroyed_;
+  };
+
+  std::atomic<int> handled{0};
+  std::atomic<int> destroyed{0};
+  {
+    acto::runtime rt;
+
+    CHECK(acto::spawn_n<A>(rt, 0, handled, destroyed).empty());
+
+    const auto actors = acto::spawn_n<A>(rt, 1000, handled, destroyed);
+
+    REQUIRE(actors.size() == 1000);
+    for (const auto& a : actors) {
+      a.send(A::M{1});
+    }
+    // Leave a half of the actors to the shutdown.
+    for (size_t i = 0; i < actors.size(); i += 2) {
+      acto::destroy_and_wait(actors[i]);
+    }
+
+    CHECK(destroyed == 500);
+
+    rt.shutdown();
+  }
+
+  CHECK(handled == 1000);
+  CHECK(destroyed == 1000);
+}
+
+TEST_CASE("Router") {
+  struct A : acto::actor {
+    struct M {
+      int key;
+    };
+
+    struct N { };
+
+    A(std::vector<int>& keys) {
+      actor::handler<M>([&keys](const M& m) { keys.push_back(m.key); });
+      actor::handler<N>([&keys] { keys.push_back(-1); });
+    }
+  };
+
+  std::vector<std::vector<int>> keys(4);
+  std::vector<acto::actor_ref> routees;
+
+  for (auto& k : keys) {
+    routees.push_back(acto::spawn<A>(acto::actor_thread::bind, k));
+  }
+
+  SECTION("round robin") {
+    auto router =
+      acto::make_router(acto::routing_strategy::round_robin, routees);
+
+    for (int i = 0; i < 8; ++i) {
+      CHECK(router.send(A::M{i}));
+    }
+    acto::this_thread::process_messages();
+
+    CHECK(keys[0] == std::vector<int>{0, 4});
+    CHECK(keys[3] == std::vector<int>{3, 7});
+  }
+
+  SECTION("random") {
+    auto router = acto::make_router(acto::routing_strategy::random, routees);
+
+    for (int i = 0; i < 1000; ++i) {
+      router.send(A::M{i});
+    }
+    acto::this_thread::process_messages();
+
+    size_t total = 0;
+    for (const auto& k : keys) {
+      CHECK(k.size() > 0);
+      total += k.size();
+    }
+    CHECK(total == 1000);
+  }
+
+  SECTION("smallest mailbox") {
+    auto router =
+      acto::make_router(acto::routing_strategy::smallest_mailbox, routees);
+
+    for (int i = 0; i < 10; ++i) {
+      router.send(A::M{i});
+    }
+    acto::this_thread::process_messages();
+
+    std::vector<size_t> sizes;
+    for (auto& k : keys) {
+      sizes.push_back(k.size());
+      k.clear();
+    }
+    std::sort(sizes.begin(), sizes.end());
+    CHECK(sizes == std::vector<size_t>{2, 2, 3, 3});
+
+    // Handled messages are not counted anymore.
+    for (int i = 0; i < 8; ++i) {
+      router.send(A::M{i});
+    }
+    acto::this_thread::process_messages();
+
+    for (const auto& k : keys) {
+      CHECK(k.size() == 2);
+    }
+  }
+
+  SECTION("consistent hash") {
+    auto router = acto::make_router(
+      acto::routing_strategy::consistent_hash, routees,
+      acto::routing_keys().key<A::M>([](const A::M& m) { return m.key; }));
+
+    for (int round = 0; round < 2; ++round) {
+      for (int i = 0; i < 100; ++i) {
+        router.send(A::M{i});
+      }
+    }
+    acto::multicast({&router, 1}, A::M{7});
+    // Messages without a key are routed in turn.
+    for (int i = 0; i < 4; ++i) {
+      router.send(A::N{});
+    }
+    acto::this_thread::process_messages();
+
+    for (const auto& k : keys) {
+      std::map<int, int> counts;
+
+      for (const int key : k) {
+        counts[key] += 1;
+      }
+      for (const auto& [key, count] : counts) {
+        CHECK(count == (key == -1 ? 1 : key == 7 ? 3 : 2));
+      }
+    }
+  }
+
+  SECTION("destroyed") {
+    auto router =
+      acto::make_router(acto::routing_strategy::round_robin, routees);
+
+    acto::destroy(router);
+    CHECK_FALSE(router.send(A::M{0}));
+    CHECK_FALSE(acto::make_router(acto::routing_strategy::random, {})
+                  .send(A::M{0}));
+  }
+
+  for (const auto& r : routees) {
+    acto::destroy(r);
+  }
+  acto::this_thread::process_messages();
+}
+
+TEST_CASE("Ask") {
+  struct Q {
+    int value;
+  };
+
+  struct R {
+    int value;
+  };
+
+  struct Hold { };
+
+  struct A : acto::actor {
+    A() {
+      actor::handler<Q>([](acto::actor_ref sender, const Q& q) {
+        // A message of another type is not accepted as the reply.
+        const bool accepted = sender.send(Q{q.value});
+
+        sender.send(R{accepted ? -1 : q.value * 2});
+        // Only the first reply is accepted.
+        sender.send(R{-1});
+      });
+      // Keeps the sender to reply later.
+      actor::handler<Hold>(
+        [this](acto::actor_ref sender) { held_ = std::move(sender); });
+      actor::handler<R>([this](const R& r) {
+        held_.send(r);
+        held_ = acto::actor_ref();
+      });
+    }
+
+  private:
+    acto::actor_ref held_;
+  };
+
+  struct Ignore { };
+
+  auto a = acto::spawn<A>();
+
+  SECTION("reply") {
+    CHECK(acto::ask<R>(a, Q{21}).get().value().value == 42);
+
+    std::vector<acto::future<R>> futures;
+    for (int i = 0; i < 100; ++i) {
+      futures.push_back(acto::ask<R>(a, Q{i}));
+    }
+    for (int i = 0; i < 100; ++i) {
+      const auto r = futures[size_t(i)].get();
+
+      REQUIRE(r);
+      CHECK(r->value == i * 2);
+      // The reply can be taken once.
+      CHECK_FALSE(futures[size_t(i)].get());
+    }
+  }
+
+  SECTION("timeout") {
+    auto f = acto::ask<R>(a, Hold{});
+
+    CHECK_FALSE(f.get_for(std::chrono::milliseconds(10)));
+    CHECK_FALSE(f.ready());
+
+    a.send(R{7});
+    CHECK(f.get().value().value == 7);
+  }
+
+  SECTION("no reply") {
+    // The actor has no handler for the request.
+    CHECK_FALSE(acto::ask<R>(a, Ignore{}).get());
+    CHECK_FALSE(acto::ask<R>(acto::actor_ref(), Q{1}).get());
+
+    // The actor drops the sender it kept.
+    auto f = acto::ask<R>(a, Hold{});
+
+    a.send(Hold{});
+    CHECK_FALSE(f.get());
+    CHECK(f.ready());
+  }
+
+  SECTION("from handler") {
+    struct B : acto::actor {
+      B(std::atomic<int>& result) {
+        // The request is sent to the context of the actor.
+        actor::handler<Q>([this, &result](const Q& q) {
+          result = acto::ask<R>(actor::context(), q).get().value().value;
+        });
+      }
+    };
+
+    std::atomic<int> result{0};
+    auto b = acto::spawn<B>(a, result);
+
+    b.send(Q{5});
+    acto::destroy_and_wait(b);
+    CHECK(result == 10);
+  }
+
+  acto::destroy_and_wait(a);
+  CHECK_FALSE(acto::ask<R>(a, Q{1}).get());
+}
+
+TEST_CASE("Coroutine handlers") {
+  struct Q {
+    int value;
+  };
+
+  struct R {
+    int value;
+  };
+
+  struct P {
+    int value;
+  };
+
+  struct Hold { };
+
+  // Replies with the doubled value, or later if asked to hold.
+  struct A : acto::actor {
+    A() {
+      actor::handler<Q>([](acto::actor_ref sender, const Q& q) {
+        sender.send(R{q.value * 2});
+      });
+      actor::handler<Hold>(
+        [this](acto::actor_ref sender) { held_ = std::move(sender); });
+      actor::handler<R>([this](const R& r) {
+        held_.send(r);
+        held_ = acto::actor_ref();
+      });
+    }
+
+  private:
+    acto::actor_ref held_;
+  };
+
+  // Logs replies of the context and values of other messages.
+  struct C : acto::actor {
+    C(std::vector<int>& log)
+      : log_(log) {
+      actor::handler<Q>(&C::do_q);
+      actor::handler<P>([this](const P& p) { log_.push_back(-p.value); });
+      actor::handler<Hold>([this]() -> acto::task {
+        const auto r = co_await acto::ask<R>(actor::context(), Hold{});
+
+        log_.push_back(r ? r->value : 0);
+      });
+    }
+
+  private:
+    acto::task do_q(acto::actor_ref, const Q& q) {
+      // The message outlives the suspension.
+      const auto r = co_await acto::ask<R>(actor::context(), q);
+
+      co_await acto::delay(std::chrono::milliseconds(1));
+      log_.push_back(r ? r->value : 0);
+    }
+
+  private:
+    std::vector<int>& log_;
+  };
+
+  auto a = acto::spawn<A>();
+
+  SECTION("ordering") {
+    std::vector<int> log;
+    auto c = acto::spawn<C>(a, log);
+
+    for (int i = 1; i <= 10; ++i) {
+      c.send(Q{i});
+      c.send(P{i});
+    }
+    acto::destroy_and_wait(c);
+
+    REQUIRE(log.size() == 20);
+    for (int i = 1; i <= 10; ++i) {
+      CHECK(log[size_t(i - 1) * 2] == i * 2);
+      CHECK(log[size_t(i - 1) * 2 + 1] == -i);
+    }
+  }
+
+  SECTION("destroy while suspended") {
+    std::vector<int> log;
+    auto c = acto::spawn<C>(a, log);
+
+    c.send(Hold{});
+    c.send(P{1});
+    // Wait for the request to be held.
+    acto::ask<R>(a, Q{0}).wait();
+    acto::destroy(c);
+    a.send(R{7});
+    acto::join(c);
+
+    CHECK(log == std::vector<int>{7, -1});
+  }
+
+  SECTION("no reply") {
+    std::vector<int> log;
+    auto c = acto::spawn<C>(acto::actor_ref(), log);
+
+    c.send(Q{1});
+    acto::destroy_and_wait(c);
+
+    CHECK(log == std::vector<int>{0});
+  }
+
+  SECTION("bound actor") {
+    std::vector<int> log;
+    auto c = acto::spawn<C>(a, acto::actor_thread::bind, log);
+
+    c.send(Q{1});
+    c.send(P{1});
+    while (log.size() < 2) {
+      acto::this_thread::process_messages();
+    }
+    acto::destroy(c);
+
+    CHECK(log == std::vector<int>{2, -1});
+  }
+
+  SECTION("frame reuse") {
+    struct D : acto::actor {
+      D(std::vector<const void*>& frames) {
+        actor::handler<P>([&frames](const P&) -> acto::task {
+          int local = 0;
+
+          frames.push_back(&local);
+          co_await acto::delay(std::chrono::milliseconds(1));
+          ++local;
+        });
+      }
+    };
+
+    std::vector<const void*> frames;
+    auto d = acto::spawn<D>(frames);
+
+    for (int i = 0; i < 3; ++i) {
+      d.send(P{i});
+    }
+    acto::destroy_and_wait(d);
+
+    REQUIRE(frames.size() == 3);
+    CHECK(frames[0] == frames[1]);
+    CHECK(frames[1] == frames[2]);
+  }
+
+  SECTION("outside of actors") {
+    auto f = [&a](int& result) -> acto::task {
+      co_await acto::delay(std::chrono::milliseconds(1));
+      result = (co_await acto::ask<R>(a, Q{4})).value().value;
+    };
+    int result = 0;
+
+    f(result);
+    CHECK(result == 8);
+  }
+
+  acto::destroy_and_wait(a);
+}
+
+TEST_CASE("Timers") {
+  struct T {
+    int value;
+  };
+
+  // Logs values of messages and counts them.
+  struct A : acto::actor {
+    A(std::vector<int>& log, std::atomic<int>& count) {
+      actor::handler<T>([&log, &count](const T& t) {
+        log.push_back(t.value);
+        count.fetch_add(1);
+      });
+    }
+  };
+
+  std::vector<int> log;
+  std::atomic<int> count{0};
+  auto a = acto::spawn<A>(log, count);
+
+  SECTION("send after") {
+    const auto start = std::chrono::steady_clock::now();
+    auto t = acto::send_after(a, std::chrono::milliseconds(5), T{1});
+
+    CHECK(t.valid());
+    while (count.load() == 0) {
+      std::this_thread::yield();
+    }
+    CHECK(std::chrono::steady_clock::now() - start >=
+          std::chrono::milliseconds(5));
+    // The message has been sent already.
+    CHECK_FALSE(t.cancel());
+
+    CHECK_FALSE(acto::send_after(acto::actor_ref(), std::chrono::seconds(0),
+                                 T{2})
+                  .valid());
+  }
+
+  SECTION("ordering") {
+    for (int i = 0; i < 100; ++i) {
+      acto::send_after(a, std::chrono::milliseconds(2), T{i});
+    }
+    while (count.load() < 100) {
+      std::this_thread::yield();
+    }
+    acto::destroy_and_wait(a);
+
+    for (int i = 0; i < 100; ++i) {
+      CHECK(log[size_t(i)] == i);
+    }
+  }
+
+  SECTION("cancel") {
+    auto t = acto::send_after(a, std::chrono::milliseconds(10), T{1});
+
+    CHECK(t.cancel());
+    CHECK_FALSE(t.cancel());
+
+    acto::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(count.load() == 0);
+  }
+
+  SECTION("periodic") {
+    auto t = acto::send_every(a, std::chrono::milliseconds(1), T{3});
+
+    while (count.load() < 5) {
+      std::this_thread::yield();
+    }
+    CHECK(t.cancel());
+
+    // A message might have been on its way while the timer was cancelled.
+    const int sent = count.load() + 1;
+
+    acto::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(count.load() <= sent);
+    CHECK_FALSE(t.cancel());
+  }
+
+  SECTION("target destroyed") {
+    auto t = acto::send_every(a, std::chrono::milliseconds(1), T{4});
+
+    acto::destroy_and_wait(a);
+    acto::this_thread::sleep_for(std::chrono::milliseconds(50));
+    // The timer has stopped after the target had been destroyed.
+    CHECK_FALSE(t.cancel());
+  }
+
+  SECTION("many timers") {
+    std::vector<acto::timer> timers;
+    std::vector<bool> cancelled(10000);
+    int expected = 0;
+
+    for (int i = 0; i < 10000; ++i) {
+      timers.push_back(acto::send_after(
+        a, std::chrono::milliseconds(20 + i % 20), T{i}));
+    }
+    for (size_t i = 0; i < timers.size(); ++i) {
+      // Slow builds may not manage to cancel all timers in time.
+      cancelled[i] = (i % 2 == 0) && timers[i].cancel();
+      expected += cancelled[i] ? 0 : 1;
+    }
+    CHECK(expected < 10000);
+    while (count.load() < expected) {
+      std::this_thread::yield();
+    }
+    acto::this_thread::sleep_for(std::chrono::milliseconds(50));
+    acto::destroy_and_wait(a);
+
+    CHECK(count.load() == expected);
+    CHECK(std::none_of(log.begin(), log.end(),
+                       [&](int v) { return cancelled[size_t(v)]; }));
+  }
+
+  acto::destroy_and_wait(a);
+}
+
+TEST_CASE("Timers racing with runtime destruction") {
+  // Counts live copies of the message.
+  struct T {
+    explicit T(std::atomic<int>& counter)
+      : live(&counter) {
+      ++*live;
+    }
+
+    T(const T& other)
+      : live(other.live) {
+      ++*live;
+    }
+
+    ~T() {
+      --*live;
+    }
+
+    std::atomic<int>* live;
+  };
+
+  struct A : acto::actor {
+    A() {
+      actor::handler<T>([] { });
+    }
+  };
+
+  std::atomic<int> live{0};
+
+  for (int i = 0; i < 100; ++i) {
+    std::atomic<bool> stop{false};
+    std::atomic<int> sent{0};
+    acto::actor_ref a;
+    std::thread sender;
+    {
+      acto::runtime rt;
+
+      a = acto::spawn<A>(rt);
+      // The reference outlives the runtime, so timers can be set while
+      // the runtime is being stopped.
+      sender = std::thread([&] {
+        while (!stop) {
+          acto::send_after(a, std::chrono::hours(1), T(live));
+          ++sent;
+        }
+      });
+      while (sent.load() < i) {
+        std::this_thread::yield();
+      }
+    }
+    stop = true;
+    sender.join();
+    a = acto::actor_ref();
+    // All pending timers have been dropped along with their messages.
+    REQUIRE(live == 0);
+  }
+}
+
+TEST_CASE("Process budget") {
+  struct Ping { };
+
+  // Keeps sending messages to itself.
+  struct S : acto::actor {
+    S(std::atomic<int>& count) {
+      actor::handler<Ping>([this, &count]() {
+        count.fetch_add(1);
+        actor::self().send(Ping{});
+      });
+    }
+  };
+
+  // Counts messages.
+  struct B : acto::actor {
+    B(std::atomic<int>& count) {
+      actor::handler<Ping>([&count]() { count.fetch_add(1); });
+    }
+  };
+
+  std::atomic<int> s_count{0};
+  std::atomic<int> t_count{0};
+  std::atomic<int> b_count{0};
+  auto s = acto::spawn<S>(acto::actor_thread::bind, s_count);
+  auto b = acto::spawn<B>(acto::actor_thread::bind, b_count);
+
+  s.send(Ping{});
+  for (int i = 0; i < 10; ++i) {
+    b.send(Ping{});
+  }
+
+  SECTION("single round") {
+    // Messages sent by the actor to itself are left for the next call.
+    CHECK(acto::this_thread::process_messages());
+    CHECK(s_count == 1);
+    CHECK(b_count == 10);
+
+    CHECK(acto::this_thread::process_messages());
+    CHECK(s_count == 2);
+    CHECK(b_count == 10);
+  }
+
+  SECTION("messages") {
+    CHECK(acto::this_thread::process_messages({.messages = 100}));
+    CHECK(s_count + b_count == 100);
+    CHECK(b_count == 10);
+
+    CHECK(acto::this_thread::process_messages({.messages = 5}));
+    CHECK(s_count == 95);
+  }
+
+  SECTION("fairness") {
+    auto t = acto::spawn<S>(acto::actor_thread::bind, t_count);
+
+    t.send(Ping{});
+    CHECK(acto::this_thread::process_messages({.messages = 1000}));
+    CHECK(s_count + t_count + b_count == 1000);
+    CHECK(s_count - t_count <= 1);
+    CHECK(t_count - s_count <= 1);
+
+    acto::destroy(t);
+  }
+
+  SECTION("time") {
+    const auto start = std::chrono::steady_clock::now();
+
+    CHECK(acto::this_thread::process_messages(
+      {.time = std::chrono::milliseconds(5)}));
+    CHECK(std::chrono::steady_clock::now() - start >=
+          std::chrono::milliseconds(5));
+    CHECK(b_count == 10);
+  }
+
+  SECTION("no messages left") {
+    acto::destroy(s);
+    // The budget is not exhausted.
+    CHECK(acto::this_thread::process_messages({.messages = 100}));
+    CHECK(b_count == 10);
+    CHECK_FALSE(acto::this_thread::process_messages({.messages = 100}));
+  }
+
+  acto::destroy(s);
+  acto::destroy(b);
+  acto::this_thread::process_messages();
+}